@@ -0,0 +1,199 @@
+#ifndef __COMPUTE_BUDGET
+#define __COMPUTE_BUDGET
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <string>
+
+#include "head_pose_estimation.hpp"
+#include "ros_parameters.hpp"
+#include "ros_stats.hpp"
+
+// TRACKING policy: minimum number of frames between two face detections
+static const unsigned int BUDGET_TRACKING_DETECTION_INTERVAL=5;
+
+// the policy is upgraded once the demand drops below this ratio of the
+// budget (hysteresis)
+static const double BUDGET_UPGRADE_THRESHOLD=0.6;
+
+/** Adapts the processing of the frames to a compute budget: a maximum frame
+ * rate, and/or a maximum processing time per second (wall-clock time of the
+ * frame callback, in ms per second of video).
+ *
+ * While the processing time demanded by the incoming frames exceeds the
+ * budget, the policy is degraded by one step every second:
+ *  - FULL: the configured processing;
+ *  - TRACKING: the face detector only runs every
+ *    BUDGET_TRACKING_DETECTION_INTERVAL frames (at least), the faces are
+ *    tracked in between;
+ *  - DOWNSCALED: in addition, the faces are detected on an image downscaled
+ *    by 2 (small faces are missed);
+ *  - SKIPPING: in addition, frames are skipped as long as the processing
+ *    time of the last second exceeds the budget.
+ * The policy is upgraded again (one step per second) once the demand drops
+ * below BUDGET_UPGRADE_THRESHOLD times the budget.
+ *
+ * Not thread-safe: admit() and record() must be called from the same thread.
+ */
+class ComputeBudget {
+
+public:
+
+    enum Policy {FULL, TRACKING, DOWNSCALED, SKIPPING};
+
+    explicit ComputeBudget(const EstimatorParameters& params) :
+        maxFps(params.maxFps),
+        cpuBudget(params.cpuBudget),
+        detectionInterval(params.detectionInterval),
+        detectionScale(params.detectionScale),
+        minFaceSize(params.minFaceSize) {}
+
+    bool enabled() const {return maxFps > 0 || cpuBudget > 0;}
+
+    /** To be called for each incoming frame: returns false if the frame
+     * must be skipped (above the maximum frame rate, or over budget).
+     */
+    bool admit() {
+        auto now = seconds();
+
+        // some tolerance for the jitter of the camera's frame rate
+        if (maxFps > 0 && has_last_admitted && now - last_admitted < 0.9 / maxFps) return false;
+
+        if (cpuBudget > 0) {
+            forget(now);
+            if (current_policy == SKIPPING && load() >= cpuBudget) {
+                frames.push_back({now, -1.});
+                return false;
+            }
+        }
+
+        last_admitted = now;
+        has_last_admitted = true;
+        return true;
+    }
+
+    /** To be called after processing an admitted frame, with its
+     * processing time (in ms). Adapts the policy (at most once per second),
+     * and returns true if it has changed.
+     */
+    bool record(double duration) {
+        if (cpuBudget <= 0) return false;
+
+        auto now = seconds();
+        frames.push_back({now, duration});
+        forget(now);
+
+        if (!has_last_adaptation) {
+            last_adaptation = now;
+            has_last_adaptation = true;
+        }
+        if (now - last_adaptation < 1.) return false;
+        last_adaptation = now;
+
+        auto d = demand();
+        if (d > cpuBudget && current_policy < SKIPPING) {
+            current_policy = static_cast<Policy>(current_policy + 1);
+            return true;
+        }
+        if (d < BUDGET_UPGRADE_THRESHOLD * cpuBudget && current_policy > FULL) {
+            current_policy = static_cast<Policy>(current_policy - 1);
+            return true;
+        }
+        return false;
+    }
+
+    /** record()s the processing time of a frame started at 'start', logs
+     * the policy changes, and reports the policy on the stats topic. To be
+     * called before stats.record().
+     */
+    void record(std::chrono::steady_clock::time_point start, StatsPublisher& stats) {
+        if (cpuBudget <= 0) return;
+
+        auto processing = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (record(processing)) {
+            ROS_INFO_STREAM("Compute budget: switching to the '" << policyName(current_policy) << "' policy");
+        }
+        stats.setStatus("compute policy", policyName(current_policy));
+        stats.setStatus("load (ms/s)", std::to_string(load()));
+    }
+
+    /** Configures the estimator for the current policy.
+     */
+    void apply(HeadPoseEstimation& estimator) const {
+        estimator.detectionInterval = detectionInterval;
+        estimator.detectionScale = detectionScale;
+        estimator.minFaceSize = minFaceSize;
+
+        if (current_policy >= TRACKING) {
+            estimator.detectionInterval = std::max(detectionInterval, BUDGET_TRACKING_DETECTION_INTERVAL);
+        }
+        if (current_policy >= DOWNSCALED) {
+            auto scale = detectionScale > 0 && detectionScale <= 1 ? detectionScale : 1.f;
+            estimator.detectionScale = scale / 2;
+            if (minFaceSize > 0) estimator.minFaceSize = 2 * minFaceSize;
+        }
+    }
+
+    Policy policy() const {return current_policy;}
+
+    static std::string policyName(Policy policy) {
+        switch (policy) {
+            case FULL: return "full";
+            case TRACKING: return "tracking";
+            case DOWNSCALED: return "downscaled";
+            case SKIPPING: return "skipping";
+        }
+        return "";
+    }
+
+    /** Processing time (in ms) of the frames of the last second.
+     */
+    double load() const {
+        double total = 0.;
+        for (const auto& f : frames) if (f.duration >= 0) total += f.duration;
+        return total;
+    }
+
+    // maximum frame rate, and processing time per second (ms); 0: no limit
+    double maxFps;
+    double cpuBudget;
+
+private:
+
+    // configured settings (FULL policy)
+    unsigned int detectionInterval;
+    float detectionScale;
+    unsigned int minFaceSize;
+
+    Policy current_policy = FULL;
+
+    struct frame {
+        double time;
+        double duration; // < 0 if skipped
+    };
+    std::deque<frame> frames; // of the last second
+
+    double last_admitted = 0., last_adaptation = 0.;
+    bool has_last_admitted = false, has_last_adaptation = false;
+
+    static double seconds() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void forget(double now) {
+        while (!frames.empty() && now - frames.front().time > 1.) frames.pop_front();
+    }
+
+    /** Processing time (ms) the frames of the last second would have needed
+     * if none had been skipped.
+     */
+    double demand() const {
+        size_t processed = 0;
+        for (const auto& f : frames) if (f.duration >= 0) processed++;
+        if (processed == 0) return 0.;
+        return load() / processed * frames.size();
+    }
+};
+
+#endif // __COMPUTE_BUDGET
@@ -1,3 +1,5 @@
+#include <cmath>
+#include <map>
 #include <string>
 #include <vector>
 #include <sstream>
@@ -9,14 +11,25 @@
 #include <std_msgs/String.h>
 #include <tf/transform_listener.h>
 
-using namespace std;
+#include <gazr/Faces.h>
 
-static const string HUMAN_FRAME_PREFIX = "face_";
+using namespace std;
 
 static const double FOV = 20. / 180 * M_PI; // radians
 static const float RANGE = 3; //m
 
-std::vector<std_msgs::ColorRGBA> colors;
+// a target is in the field of view of a face if its distance to the face's
+// main axis is less than TAN2_HALF_FOV * its distance along the axis
+static const double TAN2_HALF_FOV = tan(FOV/2) * tan(FOV/2);
+
+// if no faces message has been received for that long, the faces are not
+// visible anymore (gazr stopped, or the camera)
+static const ros::Duration MAX_FACE_AGE(1.0); // s
+
+// the positions of the targets (in the camera frame) are looked up again
+// after that long (the targets may move)
+static const ros::Duration TARGET_REFRESH(0.1); // s
+
 static std_msgs::ColorRGBA GREEN;
 static std_msgs::ColorRGBA BLUE;
 static std_msgs::ColorRGBA RED;
@@ -54,138 +67,246 @@ visualization_msgs::Marker makeMarker(int id, const string& frame, std_msgs::Col
 
     marker.color = color;
 
-    marker.lifetime = ros::Duration(0.5);
+    // only published when the focus changes: stays until deleted
+    marker.lifetime = ros::Duration(0);
 
     return marker;
 }
 
-bool isInFieldOfView(const tf::TransformListener& listener, const string& target_frame, const string& observer_frame) {
+/** Estimates which of the monitored targets (TF frames) are in the field of
+ * view of each face published by gazr on gazr/detected_faces.
+ *
+ * Event-driven: all the faces of a gazr/Faces message are tested against all
+ * the targets in one pass, with the positions of the targets looked up once
+ * per camera frame (and cached for TARGET_REFRESH). TF lookups never block.
+ * The outputs are only published when the focus of attention changes:
+ *  - actual_focus_of_attention: the targets in the field of view of the
+ *    focused face (the visible face with the lowest identifier, ie the face
+ *    tracked for the longest time), space separated;
+ *  - faces_focus_of_attention: the targets of every face, one
+ *    '<face frame>: <targets>' line per face;
+ *  - estimate_focus: a marker on each target of the focused face;
+ *  - face_0_field_of_view: the field of view of the focused face (range 0
+ *    when no face is visible), in the face's TF frame: only visible if gazr
+ *    publishes the TF frames of the faces (publish_tf, the default).
+ *
+ * The faces are named after their frame_id (<gazr prefix>_<id>).
+ */
+class FocusEstimator {
+
+public:
+
+    FocusEstimator(ros::NodeHandle& node, const vector<string>& targets) :
+        targets(targets)
+    {
+        colors = {GREEN, BLUE, RED};
 
-    tf::StampedTransform transform;
+        marker_pub = node.advertise<visualization_msgs::Marker>("estimate_focus", 10);
+        fov_pub = node.advertise<sensor_msgs::Range>("face_0_field_of_view", 1, true);
+        focus_pub = node.advertise<std_msgs::String>("actual_focus_of_attention", 1, true);
+        faces_focus_pub = node.advertise<std_msgs::String>("faces_focus_of_attention", 1, true);
 
-    try{
-        listener.lookupTransform(observer_frame, target_frame, ros::Time(0), transform);
-    }
-    catch (tf::TransformException ex){
-        ROS_ERROR("%s",ex.what());
-        ros::Duration(1.0).sleep();
-    }
+        // Prepare a range sensor msg to represent the fields of view
+        fov.radiation_type = sensor_msgs::Range::INFRARED;
+        fov.field_of_view = FOV;
+        fov.min_range = 0;
+        fov.max_range = 10;
 
-    // object behind the observer?
-    if (transform.getOrigin().x() < 0) return false;
+        faces_sub = node.subscribe("gazr/detected_faces", 1, &FocusEstimator::facesCb, this);
+        timeout_timer = node.createTimer(MAX_FACE_AGE, &FocusEstimator::timeoutCb, this);
 
-    // the field of view's main axis is the observer's X axis. So, distance to main axis is
-    // simply sqrt(y^2 + z^2)
-    double distance_to_main_axis = sqrt(transform.getOrigin().y() * transform.getOrigin().y() + transform.getOrigin().z() * transform.getOrigin().z());
+        ROS_INFO("Waiting until a face becomes visible...");
+    }
 
-    double fov_radius_at_x = tan(FOV/2) * transform.getOrigin().x();
+private:
 
-    //ROS_INFO_STREAM(target_frame << ": distance_to_main_axis: " << distance_to_main_axis << ", fov_radius_at_x: " << fov_radius_at_x);
-    if (distance_to_main_axis < fov_radius_at_x) return true;
+    vector<string> targets;
+    vector<std_msgs::ColorRGBA> colors;
 
-    return false;
+    tf::TransformListener listener;
 
-}
+    ros::Subscriber faces_sub;
+    ros::Publisher marker_pub, fov_pub, focus_pub, faces_focus_pub;
+    ros::Timer timeout_timer;
 
-int main( int argc, char** argv )
-{
-    GREEN.r = 0.; GREEN.g = 1.; GREEN.b = 0.; GREEN.a = 1.;
-    BLUE.r = 0.; BLUE.g = 0.; BLUE.b = 1.; BLUE.a = 1.;
-    RED.r = 1.; RED.g = 0.; RED.b = 0.; RED.a = 1.;
-    colors.push_back(GREEN);
-    colors.push_back(BLUE);
-    colors.push_back(RED);
+    sensor_msgs::Range fov;
 
-    ros::init(argc, argv, "estimate_focus");
-    ros::NodeHandle n;
-    ros::Rate r(30);
-    ros::Publisher marker_pub = n.advertise<visualization_msgs::Marker>("estimate_focus", 1);
-    ros::Publisher fov_pub = n.advertise<sensor_msgs::Range>("face_0_field_of_view", 1);
-    ros::Publisher frames_in_fov_pub = n.advertise<std_msgs::String>("actual_focus_of_attention", 1);
+    // positions of the targets in a camera frame
+    struct target_positions {
+        ros::Time updated;
+        vector<tf::Vector3> positions;
+        vector<char> valid;
+    };
+    map<string, target_positions> cameras;
+
+    // targets in the field of view of each visible face (by face id), and
+    // of the focused face
+    map<unsigned long, vector<char>> faces_focus;
+    string focused_frame;
+    vector<char> focused_targets;
+
+    ros::Time last_faces;
+
+    const target_positions& targetsIn(const string& camera_frame) {
+
+        auto& cache = cameras[camera_frame];
+        auto now = ros::Time::now();
+        if (!cache.positions.empty() && now - cache.updated < TARGET_REFRESH) return cache;
+
+        cache.updated = now;
+        cache.positions.assign(targets.size(), tf::Vector3(0, 0, 0));
+        cache.valid.assign(targets.size(), false);
+
+        for (size_t i = 0; i < targets.size(); ++i) {
+            // latest available transform: never waits
+            tf::StampedTransform transform;
+            try {
+                listener.lookupTransform(camera_frame, targets[i], ros::Time(0), transform);
+            }
+            catch (const tf::TransformException& ex) {
+                ROS_WARN_STREAM_THROTTLE(5, "Target " << targets[i] << " not available: " << ex.what());
+                continue;
+            }
+            cache.positions[i] = transform.getOrigin();
+            cache.valid[i] = true;
+        }
 
-    tf::TransformListener listener;
-    vector<string> frames;
+        return cache;
+    }
 
-    vector<string> monitored_frames = {"/robot_head", "/tablet", "/selection_tablet", "/experimenter"};
+    void facesCb(const gazr::FacesConstPtr& msg) {
 
+        last_faces = ros::Time::now();
 
-    // Prepare a range sensor msg to represent the fields of view
-    sensor_msgs::Range fov;
+        const auto& cache = targetsIn(msg->header.frame_id);
 
-    fov.radiation_type = sensor_msgs::Range::INFRARED;
-    fov.field_of_view = FOV;
-    fov.min_range = 0;
-    fov.max_range = 10;
-    fov.range = RANGE;
+        map<unsigned long, vector<char>> focus;
+        const gazr::Face* focused = nullptr;
 
+        for (const auto& face : msg->faces) {
 
-  ROS_INFO("Waiting until a face becomes visible...");
-  while (!listener.waitForTransform("base_footprint", "face_0", ros::Time::now(), ros::Duration(5.0))) {
-        ROS_DEBUG("Still no face visible...");
-        r.sleep();
-  }
+            tf::Transform pose;
+            tf::poseMsgToTF(face.pose, pose);
+            const auto& origin = pose.getOrigin();
+            // the field of view's main axis is the face's X axis
+            auto axis = pose.getBasis().getColumn(0);
 
-  ROS_INFO("Face detected! We can start estimating the focus of attention...");
+            auto& in_fov = focus[face.id];
+            in_fov.assign(targets.size(), false);
 
-  while (ros::ok())
-  {
-    
-    // Publish the marker
-    while (marker_pub.getNumSubscribers() < 1 && fov_pub.getNumSubscribers() < 1)
-    {
-      if (!ros::ok())
-      {
-        return 0;
-      }
-      ROS_WARN_ONCE("Please create a subscriber to the marker or field of view");
-      sleep(1);
-    }
+            for (size_t i = 0; i < targets.size(); ++i) {
+                if (!cache.valid[i]) continue;
 
-    frames.clear();
-    listener.getFrameStrings(frames);
+                auto v = cache.positions[i] - origin;
+                auto x = v.dot(axis);
 
-    int nb_faces = 0;
+                // object behind the observer?
+                if (x <= 0) continue;
 
-    std_msgs::String frames_in_fov;
+                // squared distance to the main axis vs squared radius of
+                // the field of view at x
+                in_fov[i] = v.length2() - x * x < TAN2_HALF_FOV * x * x;
+            }
 
-    for(auto frame : frames) {
-        if(frame.find(HUMAN_FRAME_PREFIX) == 0) {
+            if (!focused || face.id < focused->id) focused = &face;
+        }
 
-            nb_faces++;
+        if (focus != faces_focus) {
+            faces_focus = std::move(focus);
+            publishFacesFocus(msg->faces);
+        }
 
-            int face_idx = stoi(frame.substr(HUMAN_FRAME_PREFIX.length(), 1));
+        if (focused) {
+            // face identifiers are stable (see FaceTracker): we keep
+            // following the same person as long as they are visible
+            setFocus(focused->frame_id, faces_focus[focused->id]);
+        }
+        else {
+            setFocus("", vector<char>(targets.size(), false));
+        }
+    }
+
+    void timeoutCb(const ros::TimerEvent&) {
+        if (last_faces.isZero() || ros::Time::now() - last_faces < MAX_FACE_AGE) return;
 
-            if (face_idx == 0) {
-                
-                stringstream ss;
-                for(size_t i = 0 ; i < monitored_frames.size(); ++i) {
-                    if(isInFieldOfView(listener, monitored_frames[i], frame)) {
-                        ROS_DEBUG_STREAM(monitored_frames[i] << " is in the field of view of " << frame);
-                        marker_pub.publish(makeMarker(i, monitored_frames[i], colors[i]));
-                        if (!ss.str().empty()) ss << " ";
-                        ss << monitored_frames[i];
-                    }
-                }
-                frames_in_fov.data = ss.str();
-                frames_in_fov_pub.publish(frames_in_fov);
+        if (!faces_focus.empty()) {
+            faces_focus.clear();
+            publishFacesFocus({});
+        }
+        setFocus("", vector<char>(targets.size(), false));
+    }
 
-                fov.range = RANGE;
-                fov.header.stamp = ros::Time::now();
-                fov.header.frame_id = frame;
-                fov_pub.publish(fov); 
+    void publishFacesFocus(const vector<gazr::Face>& faces) {
+        std_msgs::String msg;
+        stringstream ss;
+        for (const auto& face : faces) {
+            ss << face.frame_id << ":";
+            const auto& in_fov = faces_focus[face.id];
+            for (size_t i = 0; i < targets.size(); ++i) {
+                if (in_fov[i]) ss << " " << targets[i];
             }
+            ss << "\n";
         }
+        msg.data = ss.str();
+        faces_focus_pub.publish(msg);
     }
-    if (nb_faces == 0) {
 
-        // hide the field of view
-        fov.range = 0;
+    /** Publishes the focus of attention of the focused face, if changed.
+     */
+    void setFocus(const string& frame, const vector<char>& in_fov) {
+
+        if (frame == focused_frame && in_fov == focused_targets) return;
 
-        fov.header.stamp = ros::Time::now();
-        fov.header.frame_id = "face_0";
-        fov_pub.publish(fov); 
+        if (focused_frame.empty() && !frame.empty()) {
+            ROS_INFO("Face detected! Estimating the focus of attention...");
+        }
 
+        std_msgs::String frames_in_fov;
+        stringstream ss;
+        for (size_t i = 0; i < targets.size(); ++i) {
+            bool was_in_fov = i < focused_targets.size() && focused_targets[i];
+            if (in_fov[i]) {
+                ROS_DEBUG_STREAM(targets[i] << " is in the field of view of " << frame);
+                if (!ss.str().empty()) ss << " ";
+                ss << targets[i];
+                if (!was_in_fov) marker_pub.publish(makeMarker(i, targets[i], colors[i % colors.size()]));
+            }
+            else if (was_in_fov) {
+                auto marker = makeMarker(i, targets[i], colors[i % colors.size()]);
+                marker.action = visualization_msgs::Marker::DELETE;
+                marker_pub.publish(marker);
+            }
+        }
+        frames_in_fov.data = ss.str();
+        focus_pub.publish(frames_in_fov);
+
+        if (frame != focused_frame) {
+            // shows (or hides) the field of view
+            fov.range = frame.empty() ? 0 : RANGE;
+            fov.header.stamp = ros::Time::now();
+            fov.header.frame_id = frame.empty() ? focused_frame : frame;
+            fov_pub.publish(fov);
+        }
+
+        focused_frame = frame;
+        focused_targets = in_fov;
     }
-    r.sleep();
-  }
+};
+
+int main( int argc, char** argv )
+{
+    GREEN.r = 0.; GREEN.g = 1.; GREEN.b = 0.; GREEN.a = 1.;
+    BLUE.r = 0.; BLUE.g = 0.; BLUE.b = 1.; BLUE.a = 1.;
+    RED.r = 1.; RED.g = 0.; RED.b = 0.; RED.a = 1.;
+
+    ros::init(argc, argv, "estimate_focus");
+    ros::NodeHandle n;
+    ros::NodeHandle private_n("~");
+
+    vector<string> monitored_frames;
+    private_n.param("targets", monitored_frames, {"/robot_head", "/tablet", "/selection_tablet", "/experimenter"});
+
+    FocusEstimator estimator(n, monitored_frames);
+
+    ros::spin();
 }
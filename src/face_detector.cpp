@@ -0,0 +1,166 @@
+#include <opencv2/core/types_c.h>  // cvIplImage
+
+#include <dlib/dnn.h>
+#include <dlib/opencv.h>
+
+#include "face_detector.hpp"
+
+using namespace dlib;
+using namespace std;
+
+std::vector<std::vector<dlib::rectangle>> FaceDetector::detect(const std::vector<cv::Mat>& images)
+{
+    std::vector<std::vector<dlib::rectangle>> detections;
+    for (const auto& image : images) {
+        detections.push_back(detect(image));
+    }
+    return detections;
+}
+
+/********************************************************************
+*                        HOG face detector                          *
+********************************************************************/
+
+HogFaceDetector::HogFaceDetector() :
+    detector(get_frontal_face_detector())
+{
+}
+
+std::vector<dlib::rectangle> HogFaceDetector::detect(const cv::Mat& image)
+{
+    auto ipl_img = cvIplImage(image);
+    if (image.channels() == 1) return detector(cv_image<unsigned char>(&ipl_img));
+    return detector(cv_image<bgr_pixel>(&ipl_img));
+}
+
+std::unique_ptr<FaceDetector> HogFaceDetector::clone() const
+{
+    return std::unique_ptr<FaceDetector>(new HogFaceDetector(*this));
+}
+
+/********************************************************************
+*                        CNN face detector                          *
+********************************************************************/
+
+// Network of dlib's MMOD face detector (see dlib's dnn_mmod_face_detection_ex.cpp)
+template <long num_filters, typename SUBNET> using con5d = con<num_filters,5,5,2,2,SUBNET>;
+template <long num_filters, typename SUBNET> using con5  = con<num_filters,5,5,1,1,SUBNET>;
+
+template <typename SUBNET> using downsampler  = relu<affine<con5d<32, relu<affine<con5d<32, relu<affine<con5d<16,SUBNET>>>>>>>>>;
+template <typename SUBNET> using rcon5  = relu<affine<con5<45,SUBNET>>>;
+
+using mmod_net_type = loss_mmod<con<1,9,9,1,1,rcon5<rcon5<rcon5<downsampler<input_rgb_image_pyramid<pyramid_down<6>>>>>>>>;
+
+struct CnnFaceDetector::Network {
+    mmod_net_type net;
+};
+
+static matrix<rgb_pixel> toDlib(const cv::Mat& image)
+{
+    auto ipl_img = cvIplImage(image);
+    matrix<rgb_pixel> img;
+    assign_image(img, cv_image<bgr_pixel>(&ipl_img));
+    return img;
+}
+
+static std::vector<dlib::rectangle> toRectangles(const std::vector<mmod_rect>& detections)
+{
+    std::vector<dlib::rectangle> faces;
+    for (const auto& d : detections) faces.push_back(d.rect);
+    return faces;
+}
+
+CnnFaceDetector::CnnFaceDetector(const string& model) :
+    net(new Network)
+{
+    deserialize(model) >> net->net;
+}
+
+CnnFaceDetector::CnnFaceDetector(const CnnFaceDetector& other) :
+    net(new Network(*other.net))
+{
+}
+
+CnnFaceDetector::~CnnFaceDetector()
+{
+}
+
+std::vector<dlib::rectangle> CnnFaceDetector::detect(const cv::Mat& image)
+{
+    return toRectangles(net->net(toDlib(image)));
+}
+
+std::vector<std::vector<dlib::rectangle>> CnnFaceDetector::detect(const std::vector<cv::Mat>& images)
+{
+    for (const auto& image : images) {
+        if (image.size() != images[0].size()) return FaceDetector::detect(images);
+    }
+
+    std::vector<matrix<rgb_pixel>> batch;
+    for (const auto& image : images) batch.push_back(toDlib(image));
+
+    std::vector<std::vector<dlib::rectangle>> detections;
+    for (const auto& image_detections : net->net(batch, batch.size())) {
+        detections.push_back(toRectangles(image_detections));
+    }
+    return detections;
+}
+
+std::unique_ptr<FaceDetector> CnnFaceDetector::clone() const
+{
+    return std::unique_ptr<FaceDetector>(new CnnFaceDetector(*this));
+}
+
+/********************************************************************
+*                     OpenCV DNN face detector                      *
+********************************************************************/
+
+#ifdef OPENCV_DNN
+
+// input size and mean of OpenCV's res10 SSD face detector
+static const cv::Size SSD_INPUT_SIZE(300, 300);
+static const cv::Scalar SSD_MEAN(104., 177., 123.);
+
+OpenCvDnnFaceDetector::OpenCvDnnFaceDetector(const string& config,
+                                             const string& model,
+                                             float confidenceThreshold) :
+    confidenceThreshold(confidenceThreshold),
+    config(config),
+    model(model),
+    net(cv::dnn::readNetFromCaffe(config, model))
+{
+#if defined(WITH_CUDA) && (CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && CV_VERSION_MINOR >= 2))
+    net.setPreferableBackend(cv::dnn::DNN_BACKEND_CUDA);
+    net.setPreferableTarget(cv::dnn::DNN_TARGET_CUDA);
+#endif
+}
+
+std::vector<dlib::rectangle> OpenCvDnnFaceDetector::detect(const cv::Mat& image)
+{
+    auto blob = cv::dnn::blobFromImage(image, 1.0, SSD_INPUT_SIZE, SSD_MEAN, false, false);
+    net.setInput(blob);
+    auto output = net.forward();
+
+    // one row per detection: [image id, label, confidence, x1, y1, x2, y2]
+    // (normalized coordinates)
+    cv::Mat detections(output.size[2], output.size[3], CV_32F, output.ptr<float>());
+
+    std::vector<dlib::rectangle> faces;
+    for (int i = 0; i < detections.rows; ++i) {
+        if (detections.at<float>(i, 2) < confidenceThreshold) continue;
+
+        faces.push_back(dlib::rectangle(static_cast<long>(detections.at<float>(i, 3) * image.cols),
+                                        static_cast<long>(detections.at<float>(i, 4) * image.rows),
+                                        static_cast<long>(detections.at<float>(i, 5) * image.cols),
+                                        static_cast<long>(detections.at<float>(i, 6) * image.rows)));
+    }
+    return faces;
+}
+
+std::unique_ptr<FaceDetector> OpenCvDnnFaceDetector::clone() const
+{
+    // a new network: cv::dnn::Net is not thread-safe
+    return std::unique_ptr<FaceDetector>(new OpenCvDnnFaceDetector(config, model, confidenceThreshold));
+}
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef __FACE_DETECTOR
+#define __FACE_DETECTOR
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <dlib/geometry/rectangle.h>
+#include <dlib/image_processing/frontal_face_detector.h>
+
+#ifdef OPENCV_DNN
+#include <opencv2/dnn.hpp>
+#endif
+
+// Size (in pixels) of the smallest face dlib's detectors (HOG and MMOD CNN,
+// with dlib's models) can find
+static const unsigned int DETECTOR_MIN_FACE_SIZE=80;
+
+/** Interface of the face detectors used by HeadPoseEstimation.
+ *
+ * Detectors are not required to be thread-safe: each thread must use its own
+ * copy, obtained with clone().
+ */
+class FaceDetector {
+
+public:
+
+    virtual ~FaceDetector() {}
+
+    /** Returns the faces detected in a BGR image (or an 8-bit grayscale
+     * image, if grayscale() is true), in image coordinates.
+     */
+    virtual std::vector<dlib::rectangle> detect(const cv::Mat& image) = 0;
+
+    /** Detects the faces in several images at once. Detectors that can
+     * process batches more efficiently (eg on a GPU) override it.
+     */
+    virtual std::vector<std::vector<dlib::rectangle>> detect(const std::vector<cv::Mat>& images);
+
+    /** True if detect(images) is more efficient than detecting the faces
+     * image by image.
+     */
+    virtual bool batched() const {return false;}
+
+    /** True if the detector also accepts grayscale images. Otherwise,
+     * HeadPoseEstimation converts grayscale images to BGR for the detector.
+     */
+    virtual bool grayscale() const {return false;}
+
+    /** Returns an independent copy of the detector. The (read-only) model
+     * data may be shared with the original.
+     */
+    virtual std::unique_ptr<FaceDetector> clone() const = 0;
+
+    /** Size (in pixels) of the smallest faces the detector can find, used by
+     * HeadPoseEstimation to downscale the image according to its
+     * minFaceSize. 0 if the detector does not depend on the image resolution.
+     */
+    virtual unsigned int minFaceSize() const = 0;
+};
+
+/** dlib's HOG frontal face detector (the default). Fast, but misses profile
+ * faces.
+ */
+class HogFaceDetector : public FaceDetector {
+
+public:
+
+    HogFaceDetector();
+
+    std::vector<dlib::rectangle> detect(const cv::Mat& image) override;
+    using FaceDetector::detect;
+
+    bool grayscale() const override {return true;}
+
+    std::unique_ptr<FaceDetector> clone() const override;
+
+    unsigned int minFaceSize() const override {return DETECTOR_MIN_FACE_SIZE;}
+
+private:
+    dlib::frontal_face_detector detector;
+};
+
+/** dlib's MMOD CNN face detector (eg mmod_human_face_detector.dat, from
+ * dlib's models): more robust to head orientation than the HOG detector, but
+ * much slower without a GPU. Runs on the GPU if dlib is built with CUDA.
+ */
+class CnnFaceDetector : public FaceDetector {
+
+public:
+
+    explicit CnnFaceDetector(const std::string& model);
+    ~CnnFaceDetector();
+
+    std::vector<dlib::rectangle> detect(const cv::Mat& image) override;
+
+    /** All the images processed in one batch must have the same size (if not,
+     * they are processed one by one).
+     */
+    std::vector<std::vector<dlib::rectangle>> detect(const std::vector<cv::Mat>& images) override;
+
+    bool batched() const override {return true;}
+
+    std::unique_ptr<FaceDetector> clone() const override;
+
+    unsigned int minFaceSize() const override {return DETECTOR_MIN_FACE_SIZE;}
+
+private:
+    CnnFaceDetector(const CnnFaceDetector& other);
+
+    // the network is only declared in face_detector.cpp: dlib/dnn.h is heavy
+    struct Network;
+    std::unique_ptr<Network> net;
+};
+
+#ifdef OPENCV_DNN
+/** OpenCV DNN SSD face detector (Caffe model, eg
+ * res10_300x300_ssd_iter_140000.caffemodel + deploy.prototxt). The image is
+ * resized to the network input size: minFaceSize and detectionScale have no
+ * effect on this detector.
+ *
+ * With WITH_CUDA, the network runs on OpenCV's CUDA backend (OpenCV >= 4.2,
+ * built with CUDA).
+ */
+class OpenCvDnnFaceDetector : public FaceDetector {
+
+public:
+
+    OpenCvDnnFaceDetector(const std::string& config,
+                          const std::string& model,
+                          float confidenceThreshold = 0.5);
+
+    std::vector<dlib::rectangle> detect(const cv::Mat& image) override;
+    using FaceDetector::detect;
+
+    std::unique_ptr<FaceDetector> clone() const override;
+
+    unsigned int minFaceSize() const override {return 0;}
+
+    float confidenceThreshold;
+
+private:
+    // kept to create the clones: cv::dnn::Net copies share their state
+    std::string config, model;
+    cv::dnn::Net net;
+};
+#endif
+
+/** Owning pointer to a face detector, that clones the detector when
+ * copied: copies of a HeadPoseEstimation never share their detector.
+ */
+class FaceDetectorPtr {
+
+public:
+
+    FaceDetectorPtr(std::unique_ptr<FaceDetector> detector = nullptr) :
+        detector(std::move(detector)) {}
+
+    FaceDetectorPtr(const FaceDetectorPtr& other) :
+        detector(other ? other->clone() : nullptr) {}
+
+    FaceDetectorPtr& operator=(const FaceDetectorPtr& other) {
+        detector = other ? other->clone() : nullptr;
+        return *this;
+    }
+
+    FaceDetectorPtr(FaceDetectorPtr&&) = default;
+    FaceDetectorPtr& operator=(FaceDetectorPtr&&) = default;
+
+    FaceDetector* operator->() const {return detector.get();}
+    FaceDetector& operator*() const {return *detector;}
+    explicit operator bool() const {return detector != nullptr;}
+
+private:
+    std::unique_ptr<FaceDetector> detector;
+};
+
+#endif // __FACE_DETECTOR
@@ -0,0 +1,69 @@
+#include <algorithm>
+#include <tuple>
+
+#include "face_tracker.hpp"
+
+using namespace std;
+using namespace dlib;
+
+static double overlap(const dlib::rectangle& a, const dlib::rectangle& b)
+{
+    auto inter = a.intersect(b).area();
+    if (inter == 0) return 0.;
+    return static_cast<double>(inter) / (a.area() + b.area() - inter);
+}
+
+std::vector<unsigned long> FaceTracker::update(const std::vector<dlib::rectangle>& faces)
+{
+    // all the (face, track) pairs that overlap enough, best first
+    std::vector<std::tuple<double, size_t, size_t>> candidates;
+    for (size_t i = 0; i < faces.size(); ++i) {
+        for (size_t j = 0; j < tracks.size(); ++j) {
+            auto iou = overlap(faces[i], tracks[j].box);
+            if (iou >= minOverlap) candidates.emplace_back(iou, i, j);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [](const std::tuple<double, size_t, size_t>& a, const std::tuple<double, size_t, size_t>& b) {
+                  return std::get<0>(a) > std::get<0>(b);
+              });
+
+    const size_t NOT_MATCHED = tracks.size();
+    std::vector<size_t> matches(faces.size(), NOT_MATCHED);
+    std::vector<bool> matched_tracks(tracks.size(), false);
+
+    for (const auto& c : candidates) {
+        size_t i, j;
+        std::tie(std::ignore, i, j) = c;
+        if (matches[i] != NOT_MATCHED || matched_tracks[j]) continue;
+        matches[i] = j;
+        matched_tracks[j] = true;
+    }
+
+    std::vector<track> new_tracks;
+    std::vector<unsigned long> ids;
+
+    for (size_t i = 0; i < faces.size(); ++i) {
+        track t;
+        t.id = matches[i] != NOT_MATCHED ? tracks[matches[i]].id : next_id++;
+        t.box = faces[i];
+        t.missed = 0;
+        new_tracks.push_back(t);
+        ids.push_back(t.id);
+    }
+
+    // lost faces
+    for (size_t j = 0; j < tracks.size(); ++j) {
+        if (matched_tracks[j] || tracks[j].missed >= lifetime) continue;
+        new_tracks.push_back(tracks[j]);
+        new_tracks.back().missed++;
+    }
+
+    tracks.swap(new_tracks);
+    return ids;
+}
+
+bool FaceTracker::isTracked(unsigned long id) const
+{
+    return std::any_of(tracks.begin(), tracks.end(), [id](const track& t) { return t.id == id; });
+}
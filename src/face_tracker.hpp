@@ -0,0 +1,53 @@
+#ifndef __FACE_TRACKER
+#define __FACE_TRACKER
+
+#include <vector>
+
+#include <dlib/geometry/rectangle.h>
+
+/** Gives a persistent identifier to each face, by associating the faces of
+ * consecutive frames.
+ *
+ * The faces of a new frame are greedily matched to the known faces, by
+ * decreasing overlap (intersection over union of their boxes). Faces that are
+ * not matched get a new identifier. A face that disappears (eg missed by the
+ * detector, or briefly occluded) keeps its identifier for 'lifetime' frames:
+ * if it reappears at about the same place in the meantime, it is recognised.
+ */
+class FaceTracker {
+
+public:
+
+    FaceTracker(unsigned int lifetime = 10, double minOverlap = 0.3) :
+        lifetime(lifetime),
+        minOverlap(minOverlap) {}
+
+    /** Returns the identifier of each face of the new frame (in the same
+     * order).
+     */
+    std::vector<unsigned long> update(const std::vector<dlib::rectangle>& faces);
+
+    /** True if the face is currently visible, or has been lost for less than
+     * 'lifetime' frames.
+     */
+    bool isTracked(unsigned long id) const;
+
+    // number of frames a lost face keeps its identifier
+    unsigned int lifetime;
+
+    // minimum intersection over union of the boxes of a face in two frames
+    double minOverlap;
+
+private:
+
+    struct track {
+        unsigned long id;
+        dlib::rectangle box; // last known position
+        unsigned int missed; // number of frames since last seen
+    };
+
+    std::vector<track> tracks;
+    unsigned long next_id = 0;
+};
+
+#endif // __FACE_TRACKER
@@ -3,7 +3,11 @@
 #include <opencv2/highgui/highgui.hpp>
 #endif
 
-#include <std_msgs/Char.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <stdexcept>
+
 #include <sensor_msgs/point_cloud2_iterator.h>
 #include <cv_bridge/cv_bridge.h>
 
@@ -11,6 +15,7 @@
 
 
 #include "facialfeaturescloud.hpp"
+#include "ros_image.hpp"
 
 using namespace depth_image_proc;
 using namespace std;
@@ -19,46 +24,167 @@ namespace enc = sensor_msgs::image_encodings;
 
 FacialFeaturesPointCloudPublisher::FacialFeaturesPointCloudPublisher(ros::NodeHandle& rosNode,
                                                                      const std::string& prefix,
-                                                                     const std::string& model):
-    estimator(model),
-    facePrefix(prefix)
+                                                                     const std::string& model,
+                                                                     const EstimatorParameters& params):
+    estimator(model, 455., params.detectionInterval, params.nbThreads),
+    facePrefix(prefix),
+    faces(prefix, params.maxReprojectionError, params.publishTf),
+    posePrediction(params.poseFiltering ? params.posePrediction : 0.),
+    budget(params),
+    depthWindow(params.depthWindow),
+    depthPose(params.depthPose),
+    depthPoseRefine(params.depthPoseRefine),
+    lazy(params.lazy),
+    publishTf(params.publishTf),
+    node(rosNode),
+    stats(rosNode, "gazr: " + prefix),
+    maxDepthDelay(params.maxDepthDelay)
 {
+    params.apply(estimator);
 
-    /// Subscribing
     rgb_it_.reset( new image_transport::ImageTransport(rosNode) );
     depth_it_.reset( new image_transport::ImageTransport(rosNode) );
 
-    // parameter for depth_image_transport hint
-    std::string depth_image_transport_param = "depth_image_transport";
+    /// Publishing
+    auto connection_cb = [this](const ros::SingleSubscriberPublisher&) { updateSubscription(); };
+    faces.advertise(rosNode, connection_cb);
+    facial_features_pub = rosNode.advertise<sensor_msgs::PointCloud2>("gazr/facial_features", 1, connection_cb, connection_cb);
 
-    // depth image can use different transport.(e.g. compressedDepth)
-    image_transport::TransportHints depth_hints("raw",ros::TransportHints(), rosNode, depth_image_transport_param);
-    sub_depth_.subscribe(*depth_it_, "depth",       1, depth_hints);
+#ifdef HEAD_POSE_ESTIMATION_DEBUG
+    auto image_connection_cb = [this](const image_transport::SingleSubscriberPublisher&) { updateSubscription(); };
+    pub = rgb_it_->advertise("gazr/detected_faces/image", 1, image_connection_cb, image_connection_cb);
+#endif
 
-    // rgb uses normal ros transport hints.
-    image_transport::TransportHints hints("raw", ros::TransportHints(), rosNode);
-    sub_rgb_.subscribe(*rgb_it_, "rgb", 1, hints);
-    sub_info_.subscribe(rosNode, "camera_info", 1);
+    if (params.depthSync == "approximate") {
+        approximate_sync_.reset( new ApproximateSynchronizer(ApproximateSyncPolicy(10), sub_rgb_, sub_depth_, sub_info_) );
+        approximate_sync_->registerCallback(bind(&FacialFeaturesPointCloudPublisher::imageCb, this, _1, _2, _3));
+    }
+    else if (params.depthSync == "nearest") {
+        rgb_sync_.reset( new RgbSynchronizer(RgbSyncPolicy(5), sub_rgb_, sub_info_) );
+        rgb_sync_->registerCallback(bind(&FacialFeaturesPointCloudPublisher::rgbCb, this, _1, _2));
+        depth_cache_.reset( new message_filters::Cache<sensor_msgs::Image>(sub_depth_, 10) );
+    }
+    else {
+        exact_sync_.reset( new ExactSynchronizer(ExactSyncPolicy(5), sub_rgb_, sub_depth_, sub_info_) );
+        exact_sync_->registerCallback(bind(&FacialFeaturesPointCloudPublisher::imageCb, this, _1, _2, _3));
+    }
 
-    /// Publishing
-    nb_detected_faces_pub = rosNode.advertise<std_msgs::Char>("gazr/detected_faces/count", 1);
-    facial_features_pub = rosNode.advertise<sensor_msgs::PointCloud2>("gazr/facial_features", 1);
+    /// Subscribing
+    updateSubscription();
+}
 
+void FacialFeaturesPointCloudPublisher::updateSubscription()
+{
+    std::lock_guard<std::mutex> lock(subscription_mutex);
+
+    bool needed = !lazy || publishTf ||
+                  faces.hasSubscribers() ||
+                  facial_features_pub.getNumSubscribers() > 0;
 #ifdef HEAD_POSE_ESTIMATION_DEBUG
-    pub = rgb_it_->advertise("gazr/detected_faces/image",1);
+    needed = needed || pub.getNumSubscribers() > 0;
 #endif
 
-    exact_sync_.reset( new ExactSynchronizer(ExactSyncPolicy(5), sub_rgb_, sub_depth_, sub_info_) );
-    exact_sync_->registerCallback(bind(&FacialFeaturesPointCloudPublisher::imageCb, this, _1, _2, _3));
+    if (needed && !subscribed) {
+        // parameter for depth_image_transport hint
+        std::string depth_image_transport_param = "depth_image_transport";
+
+        // depth image can use different transport.(e.g. compressedDepth)
+        image_transport::TransportHints depth_hints("raw",ros::TransportHints(), node, depth_image_transport_param);
+        sub_depth_.subscribe(*depth_it_, "depth",       1, depth_hints);
+
+        // rgb uses normal ros transport hints.
+        image_transport::TransportHints hints("raw", ros::TransportHints(), node);
+        sub_rgb_.subscribe(*rgb_it_, "rgb", 1, hints);
+        sub_info_.subscribe(node, "camera_info", 1);
+
+        subscribed = true;
+        if (lazy) ROS_INFO("New subscriber: subscribing to the RGB-D camera");
+    }
+    else if (!needed && subscribed) {
+        sub_depth_.unsubscribe();
+        sub_rgb_.unsubscribe();
+        sub_info_.unsubscribe();
+
+        subscribed = false;
+        ROS_INFO("No more subscribers: unsubscribing from the RGB-D camera");
+    }
+}
+
+// Colour of each facial feature in the point cloud
+static std::array<std::array<uint8_t, 3>, NB_FEATURES> featureColors()
+{
+    std::array<std::array<uint8_t, 3>, NB_FEATURES> colors;
+
+    auto fill = [&colors](size_t first, size_t last, uint8_t r, uint8_t g, uint8_t b) {
+        for (size_t i = first; i <= last; ++i) colors[i] = {{r, g, b}};
+    };
+
+    fill(0, 16, 100, 100, 100); // face silhouette
+    fill(17, 21, 255, 128, 0);  // right eyebrow
+    fill(22, 26, 255, 128, 0);  // left eyebrow
+    fill(27, 35, 0, 255, 128);  // nose
+    fill(36, 41, 0, 128, 255);  // right eye
+    fill(42, 47, 0, 0, 255);    // left eye
+    fill(48, 59, 255, 128, 128);// outer lips
+    fill(60, 67, 128, 0, 0);    // inner lips
+
+    return colors;
+}
+
+static const auto FEATURE_COLORS = featureColors();
+
+static const int MAX_DEPTH_WINDOW = 9;
+
+static uint32_t fieldOffset(const sensor_msgs::PointCloud2& cloud_msg, const string& name)
+{
+    for (const auto& field : cloud_msg.fields) {
+        if (field.name == name) return field.offset;
+    }
+    throw std::runtime_error("No field " + name + " in the point cloud");
+}
+
+/** Depth at p (which must be in the image). If window > 1, median of the
+ * valid depths in a window x window neighbourhood: single pixels are often
+ * invalid (holes of the depth map), especially at the face's edges.
+ */
+template<typename T>
+static T depthAt(const sensor_msgs::Image& depth_msg, const Point& p, int window)
+{
+    auto row = [&depth_msg](int y) {
+        return reinterpret_cast<const T*>(&depth_msg.data[y * depth_msg.step]);
+    };
+
+    if (window <= 1) return row(p.y)[p.x];
+
+    const int half = window / 2;
+    const int x_min = std::max(p.x - half, 0);
+    const int x_max = std::min(p.x + half, static_cast<int>(depth_msg.width) - 1);
+    const int y_min = std::max(p.y - half, 0);
+    const int y_max = std::min(p.y + half, static_cast<int>(depth_msg.height) - 1);
+
+    std::array<T, MAX_DEPTH_WINDOW * MAX_DEPTH_WINDOW> samples;
+    size_t nb_samples = 0;
+    for (int y = y_min; y <= y_max; ++y) {
+        const T* depth_row = row(y);
+        for (int x = x_min; x <= x_max; ++x) {
+            if (DepthTraits<T>::valid(depth_row[x])) samples[nb_samples++] = depth_row[x];
+        }
+    }
+
+    if (nb_samples == 0) return row(p.y)[p.x];
+
+    auto median = samples.begin() + nb_samples / 2;
+    std::nth_element(samples.begin(), median, samples.begin() + nb_samples);
+    return *median;
 }
 
 /**
  * Based on https://github.com/ros-perception/image_pipeline/blob/indigo/depth_image_proc/src/nodelets/point_cloud_xyzrgb.cpp
  */
 template<typename T>
-void FacialFeaturesPointCloudPublisher::makeFeatureCloud(const vector<Point> points2d,
-                                                         const sensor_msgs::ImageConstPtr& depth_msg,
-                                                         sensor_msgs::PointCloud2Ptr& cloud_msg) {
+void FacialFeaturesPointCloudPublisher::features3dAs(const vector<Point>& features,
+                                                     const sensor_msgs::Image& depth_msg,
+                                                     vector<Point3f>& points3d) const {
 
     // Use correct principal point from calibration
     float center_x = cameramodel.cx();
@@ -70,54 +196,113 @@ void FacialFeaturesPointCloudPublisher::makeFeatureCloud(const vector<Point> poi
     float constant_y = unit_scaling / cameramodel.fy();
     float bad_point = std::numeric_limits<float>::quiet_NaN ();
 
-    int row_step = depth_msg->step / sizeof(T);
+    points3d.resize(features.size());
 
-    sensor_msgs::PointCloud2Iterator<float> iter_x(*cloud_msg, "x");
-    sensor_msgs::PointCloud2Iterator<float> iter_y(*cloud_msg, "y");
-    sensor_msgs::PointCloud2Iterator<float> iter_z(*cloud_msg, "z");
-    sensor_msgs::PointCloud2Iterator<uint8_t> iter_r(*cloud_msg, "r");
-    sensor_msgs::PointCloud2Iterator<uint8_t> iter_g(*cloud_msg, "g");
-    sensor_msgs::PointCloud2Iterator<uint8_t> iter_b(*cloud_msg, "b");
+    for (size_t i = 0; i < features.size(); ++i) {
+        const auto& point2d = features[i];
 
-    for(size_t i = 0; i < points2d.size(); ++i) {
-        auto point2d = points2d[i];
-        const T* depth_row = reinterpret_cast<const T*>(&depth_msg->data[0]);
+        // out of the depth image, or not fitted by a reduced landmark model
+        bool in_image = point2d.x >= 0 && point2d.y >= 0 &&
+                        point2d.x < static_cast<int>(depth_msg.width) &&
+                        point2d.y < static_cast<int>(depth_msg.height);
 
-        depth_row += row_step * point2d.y;
+        T depth = in_image ? depthAt<T>(depth_msg, point2d, depthWindow) : T(0);
 
-        T depth = depth_row[point2d.x];
-        if(DepthTraits<T>::valid(depth))
+        if(in_image && DepthTraits<T>::valid(depth))
         {
-            // Fill in XYZ
-            *iter_x = (point2d.x - center_x) * depth * constant_x;
-            *iter_y = (point2d.y - center_y) * depth * constant_y;
-            *iter_z = DepthTraits<T>::toMeters(depth);
-
-            if(i <= 16) {*iter_r = 100; *iter_g = 100; *iter_b = 100;} // face silhouette
-            if(i >= 17 && i <= 21) {*iter_r = 255; *iter_g = 128; *iter_b = 0;} // right eyebrow
-            if(i >= 22 && i <= 26) {*iter_r = 255; *iter_g = 128; *iter_b = 0;} // left eyebrow
-            if(i >= 27 && i <= 35) {*iter_r = 0; *iter_g = 255; *iter_b = 128;} // nose
-            if(i >= 36 && i <= 41) {*iter_r = 0; *iter_g = 128; *iter_b = 255;} // right eye
-            if(i >= 42 && i <= 47) {*iter_r = 0; *iter_g = 0; *iter_b = 255;} // left eye
-            if(i >= 48 && i <= 59) {*iter_r = 255; *iter_g = 128; *iter_b = 128;} // outer lips
-            if(i >= 60 && i <= 67) {*iter_r = 128; *iter_g = 0; *iter_b = 0;} // inner lips
+            points3d[i] = Point3f((point2d.x - center_x) * depth * constant_x,
+                                  (point2d.y - center_y) * depth * constant_y,
+                                  DepthTraits<T>::toMeters(depth));
         }
         else
         {
-            *iter_x = bad_point;
-            *iter_y = bad_point;
-            *iter_z = bad_point;
+            points3d[i] = Point3f(bad_point, bad_point, bad_point);
         }
+    }
+}
 
-        ++iter_x;
-        ++iter_y;
-        ++iter_z;
+void FacialFeaturesPointCloudPublisher::features3d(const vector<Point>& features,
+                                                   const sensor_msgs::Image& depth_msg,
+                                                   vector<Point3f>& points3d) const {
 
-        ++iter_r;
-        ++iter_g;
-        ++iter_b;
+    if (depth_msg.encoding == enc::TYPE_16UC1)
+    {
+        ROS_INFO_ONCE("Depth stream is 16UC1: mm encoded as integers");
+        features3dAs<uint16_t>(features, depth_msg, points3d);
+        return;
+    }
+    else if (depth_msg.encoding == enc::TYPE_32FC1)
+    {
+        ROS_INFO_ONCE("Depth stream is 32FC1: m encoded as 32bit floats");
+        features3dAs<float>(features, depth_msg, points3d);
+        return;
     }
 
+    ROS_WARN_STREAM_ONCE("Unsupported depth encoding " << depth_msg.encoding << " (16UC1 or 32FC1 expected)");
+    float bad_point = std::numeric_limits<float>::quiet_NaN ();
+    points3d.assign(features.size(), Point3f(bad_point, bad_point, bad_point));
+}
+
+void FacialFeaturesPointCloudPublisher::makeFeatureCloud(const vector<vector<Point3f>>& all_points3d,
+                                                         size_t nb_faces,
+                                                         sensor_msgs::PointCloud2& cloud_msg) const {
+
+    // the points are written directly in the message buffer
+    const auto offset_x = fieldOffset(cloud_msg, "x");
+    const auto offset_y = fieldOffset(cloud_msg, "y");
+    const auto offset_z = fieldOffset(cloud_msg, "z");
+    const auto offset_rgb = fieldOffset(cloud_msg, "rgb"); // packed as b, g, r, a
+
+    uint8_t* point = cloud_msg.data.data();
+
+    for (size_t face = 0; face < nb_faces; ++face) {
+        const auto& points3d = all_points3d[face];
+        for (size_t i = 0; i < NB_FEATURES; ++i, point += cloud_msg.point_step) {
+            const auto& p = points3d[i];
+
+            *reinterpret_cast<float*>(point + offset_x) = p.x;
+            *reinterpret_cast<float*>(point + offset_y) = p.y;
+            *reinterpret_cast<float*>(point + offset_z) = p.z;
+
+            if (!cvIsNaN(p.z)) {
+                point[offset_rgb] = FEATURE_COLORS[i][2];
+                point[offset_rgb + 1] = FEATURE_COLORS[i][1];
+                point[offset_rgb + 2] = FEATURE_COLORS[i][0];
+            }
+        }
+    }
+
+}
+
+void FacialFeaturesPointCloudPublisher::rgbCb(const sensor_msgs::ImageConstPtr& rgb_msg,
+                                              const sensor_msgs::CameraInfoConstPtr& camerainfo) {
+
+    auto depth_msg = nearestDepth(rgb_msg->header.stamp);
+    if (!depth_msg) {
+        ROS_DEBUG_STREAM("No depth frame within " << maxDepthDelay << "s of the RGB frame: no 3D facial features");
+    }
+
+    imageCb(rgb_msg, depth_msg, camerainfo);
+}
+
+sensor_msgs::ImageConstPtr FacialFeaturesPointCloudPublisher::nearestDepth(const ros::Time& stamp) const {
+
+    auto before = depth_cache_->getElemBeforeTime(stamp);
+    auto after = depth_cache_->getElemAfterTime(stamp);
+
+    sensor_msgs::ImageConstPtr nearest;
+    double delay = maxDepthDelay;
+
+    for (const auto& candidate : {before, after}) {
+        if (!candidate) continue;
+        auto d = std::abs((candidate->header.stamp - stamp).toSec());
+        if (d <= delay) {
+            nearest = candidate;
+            delay = d;
+        }
+    }
+
+    return nearest;
 }
 
 void FacialFeaturesPointCloudPublisher::imageCb(const sensor_msgs::ImageConstPtr& rgb_msg,
@@ -126,6 +311,12 @@ void FacialFeaturesPointCloudPublisher::imageCb(const sensor_msgs::ImageConstPtr
 
     ROS_INFO_ONCE("First pair (rgb, depth) received");
 
+    // over the compute budget: the skipped frames are counted as dropped by
+    // the stats
+    if (!budget.admit()) return;
+    auto processing_start = std::chrono::steady_clock::now();
+    if (budget.enabled()) budget.apply(estimator);
+
     // updating the camera model is cheap if not modified
     cameramodel.fromCameraInfo(camerainfo);
 
@@ -135,8 +326,9 @@ void FacialFeaturesPointCloudPublisher::imageCb(const sensor_msgs::ImageConstPtr
 
     // hopefully no copy here:
     //  - assignement operator of cv::Mat does not copy the data
-    //  - toCvShare does no copy if the default (source) encoding is used.
-    auto rgb = cv_bridge::toCvShare(rgb_msg, "bgr8")->image; 
+    //  - toCvShare does no copy if the default (source) encoding is used
+    //    (bgr8 or mono8, see estimatorImage()).
+    auto rgb = estimatorImage(rgb_msg)->image;
 
     // got an empty image!
     if (rgb.size().area() == 0) return;
@@ -145,81 +337,102 @@ void FacialFeaturesPointCloudPublisher::imageCb(const sensor_msgs::ImageConstPtr
     *                      Faces detection                           *
     ********************************************************************/
 
-    auto all_features = estimator.update(rgb);
+    auto all_features = estimator.update(rgb, rgb_msg->header.stamp.toSec());
+
+    // same timestamp as the frame (or later, if extrapolated)
+    std_msgs::Header faces_header;
+    faces_header.stamp = rgb_msg->header.stamp + ros::Duration(posePrediction);
+    faces_header.frame_id = cameramodel.tfFrame();
+
     if(all_features.empty())
     {
+        // no face anymore: 0 face count, and empty faces message
+        auto start = std::chrono::steady_clock::now();
+        faces.publish(faces_header, 0, {}, {}, {});
+        auto publishing = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        budget.record(processing_start, stats);
+        stats.record(rgb_msg->header, estimator.timings(), publishing);
         return;
     }
     else
     {
-        if(all_features.size() > 1)
+        auto start = std::chrono::steady_clock::now();
+
+        // the head poses are only computed if published
+        bool poses_wanted = faces.posesWanted();
+#ifdef HEAD_POSE_ESTIMATION_DEBUG
+        poses_wanted = poses_wanted || pub.getNumSubscribers() > 0;
+#endif
+
+        // the 3D facial features (and the point cloud) are only computed
+        // if someone listens, or for the depth-based head pose
+        bool cloud_wanted = depth_msg && facial_features_pub.getNumSubscribers() > 0;
+
+        // sampled once per face into the reused buffer, then copied into
+        // the cloud and/or used for the depth-based poses
+        size_t nb_faces3d = 0;
+        if (depth_msg && (cloud_wanted || (depthPose && poses_wanted)))
         {
-            ROS_WARN("More than one face detected. 3D facial features computed for the first one only");
+            if (points3d_buffer.size() < all_features.size()) points3d_buffer.resize(all_features.size());
+            for (size_t i = 0; i < all_features.size(); ++i) {
+                features3d(all_features[i], *depth_msg, points3d_buffer[i]);
+            }
+            nb_faces3d = all_features.size();
         }
 
-        auto features = all_features[0];
+        if (cloud_wanted)
+        {
+            // Allocate new point cloud message: the facial features of
+            // all the faces (NB_FEATURES points per face)
+            sensor_msgs::PointCloud2Ptr cloud_msg (new sensor_msgs::PointCloud2);
+            cloud_msg->header = depth_msg->header; // Use depth image time stamp
+            cloud_msg->is_dense = false;
+            cloud_msg->is_bigendian = false;
+
+            sensor_msgs::PointCloud2Modifier pcd_modifier(*cloud_msg);
+            pcd_modifier.setPointCloud2FieldsByString(2, "xyz", "rgb");
+            pcd_modifier.resize(NB_FEATURES * all_features.size());
+
+            makeFeatureCloud(points3d_buffer, nb_faces3d, *cloud_msg);
 
-        // Allocate new point cloud message
-        sensor_msgs::PointCloud2Ptr cloud_msg (new sensor_msgs::PointCloud2);
-        cloud_msg->header = depth_msg->header; // Use depth image time stamp
-        cloud_msg->height = 1;
-        cloud_msg->width  = 68; // nb of facial features
-        cloud_msg->is_dense = false;
-        cloud_msg->is_bigendian = false;
+            facial_features_pub.publish(cloud_msg);
+        }
 
-        sensor_msgs::PointCloud2Modifier pcd_modifier(*cloud_msg);
-        pcd_modifier.setPointCloud2FieldsByString(2, "xyz", "rgb");
+        // timed here: the depth-based poses are not timed by the estimator
+        auto pose_start = std::chrono::steady_clock::now();
 
-        if (depth_msg->encoding == enc::TYPE_16UC1)
+        std::vector<head_pose> poses;
+        if (poses_wanted && depthPose && nb_faces3d > 0)
         {
-            ROS_INFO_ONCE("Depth stream is 16UC1: mm encoded as integers");
-            makeFeatureCloud<uint16_t>(features, depth_msg, cloud_msg);
+            poses.resize(all_features.size());
+            for (size_t i = 0; i < all_features.size(); ++i) {
+                // not enough valid depth: PnP only
+                if (!estimator.depthPose(i, points3d_buffer[i], poses[i], depthPoseRefine)) {
+                    poses[i] = estimator.pose(i);
+                }
+            }
         }
-        else if (depth_msg->encoding == enc::TYPE_32FC1)
+        else if (poses_wanted)
         {
-            ROS_INFO_ONCE("Depth stream is 32FC1: m encoded as 32bit floats");
-            makeFeatureCloud<float>(features, depth_msg, cloud_msg);
+            poses = estimator.poses();
         }
 
-        facial_features_pub.publish(cloud_msg);
+        auto timings = estimator.timings();
+        timings.pnp = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - pose_start).count();
 
-    
-        auto poses = estimator.poses();
 #ifdef HEAD_POSE_ESTIMATION_DEBUG
-        ROS_INFO_STREAM(poses.size() << " faces detected.");
+        ROS_INFO_STREAM(all_features.size() << " faces detected.");
 #endif
 
-        std_msgs::Char nb_faces;
-        nb_faces.data = poses.size();
-
-        nb_detected_faces_pub.publish(nb_faces);
-
-        for(size_t face_idx = 0; face_idx < poses.size(); ++face_idx) {
-
-            auto trans = poses[face_idx];
-
-            tf::Transform face_pose;
-
-            face_pose.setOrigin( tf::Vector3( trans(0,3),
-                                              trans(1,3),
-                                              trans(2,3)) );
-
-            tf::Quaternion qrot;
-            tf::Matrix3x3 mrot(
-                    trans(0,0), trans(0,1), trans(0,2),
-                    trans(1,0), trans(1,1), trans(1,2),
-                    trans(2,0), trans(2,1), trans(2,2));
-            mrot.getRotation(qrot);
-            face_pose.setRotation(qrot);
-
-            tf::StampedTransform transform(face_pose, 
-                    rgb_msg->header.stamp,  // publish the transform with the same timestamp as the frame originally used
-                    cameramodel.tfFrame(),
-                    facePrefix + "_" + to_string(face_idx));
-            br.sendTransform(transform);
-
+        vector<double> reprojection_errors;
+        for (size_t i = 0; i < poses.size(); ++i) {
+            reprojection_errors.push_back(estimator.reprojectionError(i));
+            if (posePrediction > 0) poses[i] = estimator.predictedPose(i, posePrediction);
         }
 
+        faces.publish(faces_header, all_features.size(), poses, reprojection_errors, estimator.faceIds());
+
 #ifdef HEAD_POSE_ESTIMATION_DEBUG
         if(pub.getNumSubscribers() > 0) {
             ROS_INFO_ONCE("Starting to publish face tracking output for debug");
@@ -227,6 +440,11 @@ void FacialFeaturesPointCloudPublisher::imageCb(const sensor_msgs::ImageConstPtr
             pub.publish(debugmsg);
         }
 #endif
+
+        // publishing time: point cloud, faces and TF frames (excluding the pose estimation)
+        auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        budget.record(processing_start, stats);
+        stats.record(rgb_msg->header, timings, elapsed - timings.pnp);
     }
 }
 
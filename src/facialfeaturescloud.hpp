@@ -1,10 +1,11 @@
+#include <mutex>
 #include <vector>
 
 #include <opencv2/core/core.hpp>
 #include <ros/ros.h>
-#include <tf/transform_broadcaster.h>
 #include <image_transport/image_transport.h>
 #include <image_transport/subscriber_filter.h>
+#include <message_filters/cache.h>
 #include <message_filters/subscriber.h>
 #include <message_filters/time_synchronizer.h>
 #include <message_filters/sync_policies/approximate_time.h>
@@ -14,7 +15,11 @@
 
 #include <image_geometry/pinhole_camera_model.h>
 
+#include "compute_budget.hpp"
 #include "head_pose_estimation.hpp"
+#include "ros_faces.hpp"
+#include "ros_parameters.hpp"
+#include "ros_stats.hpp"
 
 /**
  * This class is heavily based on https://github.com/ros-perception/image_pipeline/blob/indigo/depth_image_proc/src/nodelets/point_cloud_xyzrgb.cpp
@@ -24,30 +29,84 @@ class FacialFeaturesPointCloudPublisher {
 public:
     FacialFeaturesPointCloudPublisher(ros::NodeHandle& rosNode,
                                       const std::string& prefix,
-                                      const std::string& model);
+                                      const std::string& model,
+                                      const EstimatorParameters& params = EstimatorParameters());
 
+    /** Processes a RGB frame, with its depth frame (that may be null in
+     * 'nearest' synchronization mode: no 3D facial feature is computed then).
+     */
     void imageCb(const sensor_msgs::ImageConstPtr& rgb_msg,
                  const sensor_msgs::ImageConstPtr& depth_msg,
                  const sensor_msgs::CameraInfoConstPtr& depth_camerainfo);
 private:
 
+    /** Computes the 3D positions (in the camera frame, in meters) of the
+     * facial features into points3d, NaN where the depth is not valid.
+     * points3d is resized to the number of features (no allocation if
+     * reused).
+     */
+    void features3d(const std::vector<cv::Point>& features,
+                    const sensor_msgs::Image& depth_msg,
+                    std::vector<cv::Point3f>& points3d) const;
+
     template<typename T>
-    void makeFeatureCloud(const std::vector<cv::Point> points2d,
-                          const sensor_msgs::ImageConstPtr& depth_msg,
-                          sensor_msgs::PointCloud2Ptr& cloud_msg);
+    void features3dAs(const std::vector<cv::Point>& features,
+                      const sensor_msgs::Image& depth_msg,
+                      std::vector<cv::Point3f>& points3d) const;
+
+    /** Fills the (already allocated) point cloud with the 3D facial
+     * features of the first nb_faces faces of all_points3d: NB_FEATURES
+     * points per face, in the same order.
+     */
+    void makeFeatureCloud(const std::vector<std::vector<cv::Point3f>>& all_points3d,
+                          size_t nb_faces,
+                          sensor_msgs::PointCloud2& cloud_msg) const;
+
+    // 3D facial features of the faces of the current frame (the first ones
+    // only: the buffer is reused from frame to frame, and never shrinks)
+    std::vector<std::vector<cv::Point3f>> points3d_buffer;
 
     image_geometry::PinholeCameraModel cameramodel;
 
     cv::Mat inputImage;
 
-    tf::TransformBroadcaster br;
-    tf::Transform transform;
-
     HeadPoseEstimation estimator;
 
     // prefix prepended to TF frames generated for each frame
     std::string facePrefix;
 
+    // face count, faces and TF frames
+    FacesPublisher faces;
+
+    // the poses are published that many seconds in the future (extrapolated)
+    double posePrediction;
+
+    // adapts the processing to the compute budget
+    ComputeBudget budget;
+
+    // depth of a facial feature: median of the valid depths in a
+    // depthWindow x depthWindow window around it (1: single pixel)
+    int depthWindow;
+
+    // if true, the head poses are computed by aligning the head model to the
+    // 3D facial features (optionally refined by PnP) instead of by PnP only
+    bool depthPose;
+    bool depthPoseRefine;
+
+    // if lazy, the camera is only subscribed while someone listens to our
+    // outputs (or if TF frames are published)
+    bool lazy;
+    bool publishTf;
+
+    ros::NodeHandle node;
+    std::mutex subscription_mutex;
+    bool subscribed = false;
+
+    /** (Un)subscribes to the RGB-D camera, depending on the subscribers of
+     * our outputs. Called by the publishers' (dis)connection callbacks.
+     */
+    void updateSubscription();
+
     // Subscriptions
     /////////////////////////////////////////////////////////
     std::shared_ptr<image_transport::ImageTransport> rgb_it_;
@@ -58,19 +117,40 @@ private:
 
     // Publishers
     /////////////////////////////////////////////////////////
-    ros::Publisher nb_detected_faces_pub;
-
     ros::Publisher facial_features_pub;
+
+    // processing statistics, on gazr/stats
+    StatsPublisher stats;
     
 #ifdef HEAD_POSE_ESTIMATION_DEBUG
     image_transport::Publisher pub;
 #endif
 
-    // typedef message_filters::sync_policies::ApproximateTime<sensor_msgs::Image, sensor_msgs::Image, sensor_msgs::CameraInfo> SyncPolicy;
+    // Synchronization of the RGB and depth streams (see EstimatorParameters::depthSync)
+    /////////////////////////////////////////////////////////
+    typedef message_filters::sync_policies::ApproximateTime<sensor_msgs::Image, sensor_msgs::Image, sensor_msgs::CameraInfo> ApproximateSyncPolicy;
     typedef message_filters::sync_policies::ExactTime<sensor_msgs::Image, sensor_msgs::Image, sensor_msgs::CameraInfo> ExactSyncPolicy;
-    // typedef message_filters::Synchronizer<SyncPolicy> Synchronizer;
+    typedef message_filters::Synchronizer<ApproximateSyncPolicy> ApproximateSynchronizer;
     typedef message_filters::Synchronizer<ExactSyncPolicy> ExactSynchronizer;
-    // std::shared_ptr<Synchronizer> sync_;
+    std::shared_ptr<ApproximateSynchronizer> approximate_sync_;
     std::shared_ptr<ExactSynchronizer> exact_sync_;
+
+    // 'nearest' mode: the RGB stream (with its camera_info) is processed at
+    // full rate, and the depth frames are only cached
+    typedef message_filters::sync_policies::ExactTime<sensor_msgs::Image, sensor_msgs::CameraInfo> RgbSyncPolicy;
+    typedef message_filters::Synchronizer<RgbSyncPolicy> RgbSynchronizer;
+    std::shared_ptr<RgbSynchronizer> rgb_sync_;
+    std::shared_ptr<message_filters::Cache<sensor_msgs::Image>> depth_cache_;
+
+    // depth frames further than that (in seconds) from the RGB frame are not used
+    double maxDepthDelay;
+
+    void rgbCb(const sensor_msgs::ImageConstPtr& rgb_msg,
+               const sensor_msgs::CameraInfoConstPtr& camerainfo);
+
+    /** Returns the cached depth frame closest to stamp, or null if none is
+     * closer than maxDepthDelay.
+     */
+    sensor_msgs::ImageConstPtr nearestDepth(const ros::Time& stamp) const;
 };
 
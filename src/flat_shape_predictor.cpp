@@ -0,0 +1,187 @@
+#include <cstring>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "flat_shape_predictor.hpp"
+
+using namespace dlib;
+using namespace std;
+
+static const char MAGIC[8] = {'G', 'A', 'Z', 'R', 'S', 'H', 'P', '\0'};
+
+FlatShapePredictor::FlatShapePredictor(const string& filename) :
+    data(nullptr),
+    size(0)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) throw serialization_error("Unable to open " + filename);
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < static_cast<off_t>(sizeof(flat_model_header))) {
+        close(fd);
+        throw serialization_error(filename + " is not a valid flat shape predictor model");
+    }
+    size = st.st_size;
+
+    // MAP_SHARED: the pages are shared with the other processes mapping the
+    // same file. The mapping remains valid after closing the file.
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) throw serialization_error("Unable to map " + filename);
+    data = mapping;
+
+    header = static_cast<const flat_model_header*>(data);
+
+    if (memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->version != VERSION) {
+        munmap(const_cast<void*>(data), size);
+        throw serialization_error(filename + " is not a flat shape predictor model (or has an unsupported version)");
+    }
+
+    const size_t shape_size = 2 * header->num_parts;
+    const size_t nb_trees = static_cast<size_t>(header->num_cascades) * header->num_trees;
+    const size_t nb_features = static_cast<size_t>(header->num_cascades) * header->num_features;
+
+    const size_t expected_size = sizeof(flat_model_header)
+                                 + shape_size * sizeof(float)
+                                 + nb_features * sizeof(uint32_t)
+                                 + nb_features * 2 * sizeof(float)
+                                 + nb_trees * header->num_splits * sizeof(flat_split)
+                                 + nb_trees * (header->num_splits + 1) * shape_size * sizeof(float);
+
+    if (size != expected_size) {
+        munmap(const_cast<void*>(data), size);
+        throw serialization_error(filename + " is truncated or corrupted");
+    }
+
+    auto ptr = static_cast<const char*>(data) + sizeof(flat_model_header);
+
+    auto initial_shape_data = reinterpret_cast<const float*>(ptr);
+    ptr += shape_size * sizeof(float);
+    anchor_idx = reinterpret_cast<const uint32_t*>(ptr);
+    ptr += nb_features * sizeof(uint32_t);
+    deltas = reinterpret_cast<const float*>(ptr);
+    ptr += nb_features * 2 * sizeof(float);
+    splits = reinterpret_cast<const flat_split*>(ptr);
+    ptr += nb_trees * header->num_splits * sizeof(flat_split);
+    leaves = reinterpret_cast<const float*>(ptr);
+
+    initial_shape.set_size(shape_size);
+    for (size_t i = 0; i < shape_size; ++i) initial_shape(i) = initial_shape_data[i];
+}
+
+FlatShapePredictor::~FlatShapePredictor()
+{
+    if (data) munmap(const_cast<void*>(data), size);
+}
+
+bool FlatShapePredictor::isFlatModel(const string& filename)
+{
+    ifstream in(filename, ios::binary);
+    char magic[sizeof(MAGIC)];
+    if (!in.read(magic, sizeof(magic))) return false;
+    return memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+template<typename T>
+static void writeArray(ofstream& out, const T* values, size_t n)
+{
+    out.write(reinterpret_cast<const char*>(values), n * sizeof(T));
+}
+
+void convertShapePredictor(const string& dlib_model, const string& flat_model)
+{
+    // same fields, in the same order, as dlib's deserialize(shape_predictor&)
+    ifstream in(dlib_model, ios::binary);
+    if (!in) throw serialization_error("Unable to open " + dlib_model);
+
+    int version = 0;
+    matrix<float,0,1> initial_shape;
+    std::vector<std::vector<impl::regression_tree>> forests;
+    std::vector<std::vector<unsigned long>> anchor_idx;
+    std::vector<std::vector<dlib::vector<float,2>>> deltas;
+
+    deserialize(version, in);
+    if (version != 1) throw serialization_error("Unexpected version found while deserializing dlib::shape_predictor.");
+    deserialize(initial_shape, in);
+    deserialize(forests, in);
+    deserialize(anchor_idx, in);
+    deserialize(deltas, in);
+
+    if (forests.empty() || forests[0].empty() || deltas.size() != forests.size() || anchor_idx.size() != forests.size()) {
+        throw serialization_error(dlib_model + " is not a valid shape predictor");
+    }
+
+    FlatShapePredictor::flat_model_header header;
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = FlatShapePredictor::VERSION;
+    header.num_parts = initial_shape.size() / 2;
+    header.num_cascades = forests.size();
+    header.num_trees = forests[0].size();
+    header.num_splits = forests[0][0].splits.size();
+    header.num_features = deltas[0].size();
+
+    // the flat format requires the same number of trees per cascade, and the
+    // same depth for each tree (the case of the models trained by dlib)
+    for (size_t c = 0; c < forests.size(); ++c) {
+        if (forests[c].size() != header.num_trees ||
+            deltas[c].size() != header.num_features ||
+            anchor_idx[c].size() != header.num_features) {
+            throw serialization_error("All the cascades must have the same number of trees and feature pixels");
+        }
+        for (const auto& tree : forests[c]) {
+            if (tree.splits.size() != header.num_splits ||
+                tree.leaf_values.size() != header.num_splits + 1) {
+                throw serialization_error("All the regression trees must have the same depth");
+            }
+        }
+    }
+
+    ofstream out(flat_model, ios::binary);
+    if (!out) throw serialization_error("Unable to create " + flat_model);
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    std::vector<float> shape(initial_shape.begin(), initial_shape.end());
+    writeArray(out, shape.data(), shape.size());
+
+    for (const auto& anchors : anchor_idx) {
+        std::vector<uint32_t> values(anchors.begin(), anchors.end());
+        writeArray(out, values.data(), values.size());
+    }
+
+    for (const auto& cascade_deltas : deltas) {
+        for (const auto& delta : cascade_deltas) {
+            float values[2] = {delta.x(), delta.y()};
+            writeArray(out, values, 2);
+        }
+    }
+
+    for (const auto& forest : forests) {
+        for (const auto& tree : forest) {
+            for (const auto& split : tree.splits) {
+                FlatShapePredictor::flat_split s = {static_cast<uint32_t>(split.idx1),
+                                                    static_cast<uint32_t>(split.idx2),
+                                                    split.thresh};
+                writeArray(out, &s, 1);
+            }
+        }
+    }
+
+    for (const auto& forest : forests) {
+        for (const auto& tree : forest) {
+            for (const auto& leaf : tree.leaf_values) {
+                if (static_cast<size_t>(leaf.size()) != shape.size()) {
+                    throw serialization_error("Invalid leaf size");
+                }
+                std::vector<float> values(leaf.begin(), leaf.end());
+                writeArray(out, values.data(), values.size());
+            }
+        }
+    }
+
+    if (!out) throw serialization_error("Error while writing " + flat_model);
+}
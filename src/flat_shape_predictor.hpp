@@ -0,0 +1,157 @@
+#ifndef __FLAT_SHAPE_PREDICTOR
+#define __FLAT_SHAPE_PREDICTOR
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <dlib/image_processing.h>
+
+/** A read-only, memory-mapped version of dlib's shape_predictor.
+ *
+ * dlib's models (eg shape_predictor_68_face_landmarks.dat) are serialized as
+ * a stream that must be fully parsed (and copied in RAM) at load time. The
+ * flat format stores the same regression trees as plain arrays, that are
+ * used in place from a read-only memory mapping: loading is near-instant,
+ * the pages are only read from disk when first used, and they are shared by
+ * all the processes using the same model file.
+ *
+ * Use gazr_convert_model (or convertShapePredictor()) to convert a dlib model.
+ * The predictions are identical to dlib's.
+ *
+ * File layout (native endianness, 4-byte aligned):
+ *  - header (see flat_model_header)
+ *  - initial shape: float[2 * num_parts]
+ *  - feature pixels anchors: uint32[num_cascades * num_features]
+ *  - feature pixels deltas: float[num_cascades * num_features * 2]
+ *  - splits: flat_split[num_cascades * num_trees * num_splits]
+ *  - leaves: float[num_cascades * num_trees * (num_splits + 1) * 2 * num_parts]
+ */
+class FlatShapePredictor {
+
+public:
+
+    static const uint32_t VERSION = 1;
+
+    struct flat_model_header {
+        char magic[8];  // "GAZRSHP\0"
+        uint32_t version;
+        uint32_t num_parts;
+        uint32_t num_cascades;
+        uint32_t num_trees;     // per cascade
+        uint32_t num_splits;    // per tree
+        uint32_t num_features;  // feature pixels per cascade
+    };
+
+    struct flat_split {
+        uint32_t idx1;
+        uint32_t idx2;
+        float thresh;
+    };
+
+    /** Maps the model. Throws dlib::serialization_error if the file can not
+     * be read, or is not a valid flat model.
+     */
+    explicit FlatShapePredictor(const std::string& filename);
+    ~FlatShapePredictor();
+
+    FlatShapePredictor(const FlatShapePredictor&) = delete;
+    FlatShapePredictor& operator=(const FlatShapePredictor&) = delete;
+
+    /** Returns true if filename starts with the flat model magic bytes.
+     */
+    static bool isFlatModel(const std::string& filename);
+
+    unsigned long num_parts() const {return header->num_parts;}
+
+    /** Same as dlib::shape_predictor::operator()
+     */
+    template <typename image_type>
+    dlib::full_object_detection operator()(const image_type& img, const dlib::rectangle& rect) const;
+
+private:
+
+    const void* data;
+    size_t size;
+
+    const flat_model_header* header;
+    const uint32_t* anchor_idx;
+    const float* deltas;
+    const flat_split* splits;
+    const float* leaves;
+
+    // the initial shape is small: copied in a dlib matrix, as expected by
+    // dlib's helpers
+    dlib::matrix<float,0,1> initial_shape;
+};
+
+/** Reads a dlib shape predictor model, and writes it in the flat format.
+ * Throws dlib::serialization_error on failure (including if the trees of the
+ * model do not all have the same depth).
+ */
+void convertShapePredictor(const std::string& dlib_model, const std::string& flat_model);
+
+
+template <typename image_type>
+dlib::full_object_detection FlatShapePredictor::operator()(const image_type& img_, const dlib::rectangle& rect) const
+{
+    using namespace dlib;
+    using namespace dlib::impl;
+
+    const size_t shape_size = 2 * header->num_parts;
+    const size_t num_leaves = header->num_splits + 1;
+
+    matrix<float,0,1> current_shape = initial_shape;
+    float* shape = &current_shape(0);
+
+    const point_transform_affine tform_to_img = unnormalizing_tform(rect);
+    const dlib::rectangle area = get_rect(img_);
+    const_image_view<image_type> img(img_);
+
+    std::vector<float> feature_pixel_values(header->num_features);
+
+    for (size_t iter = 0; iter < header->num_cascades; ++iter)
+    {
+        // same as dlib's impl::extract_feature_pixel_values()
+        const matrix<float,2,2> tform = matrix_cast<float>(find_tform_between_shapes(initial_shape, current_shape).get_m());
+        const uint32_t* anchors = anchor_idx + iter * header->num_features;
+        const float* cascade_deltas = deltas + 2 * iter * header->num_features;
+
+        for (size_t i = 0; i < header->num_features; ++i)
+        {
+            dlib::vector<float,2> delta(cascade_deltas[2 * i], cascade_deltas[2 * i + 1]);
+            dlib::point p = tform_to_img(tform * delta + location(current_shape, anchors[i]));
+            if (area.contains(p))
+                feature_pixel_values[i] = get_pixel_intensity(img[p.y()][p.x()]);
+            else
+                feature_pixel_values[i] = 0;
+        }
+
+        // evaluate all the trees at this level of the cascade
+        for (size_t t = 0; t < header->num_trees; ++t)
+        {
+            const size_t tree = iter * header->num_trees + t;
+            const flat_split* tree_splits = splits + tree * header->num_splits;
+
+            unsigned long i = 0;
+            while (i < header->num_splits)
+            {
+                const auto& split = tree_splits[i];
+                if (feature_pixel_values[split.idx1] - feature_pixel_values[split.idx2] > split.thresh)
+                    i = 2 * i + 1;
+                else
+                    i = 2 * i + 2;
+            }
+
+            const float* leaf = leaves + (tree * num_leaves + i - header->num_splits) * shape_size;
+            for (size_t k = 0; k < shape_size; ++k) shape[k] += leaf[k];
+        }
+    }
+
+    std::vector<dlib::point> parts(header->num_parts);
+    for (size_t i = 0; i < parts.size(); ++i)
+        parts[i] = tform_to_img(location(current_shape, i));
+    return full_object_detection(rect, parts);
+}
+
+#endif // __FLAT_SHAPE_PREDICTOR
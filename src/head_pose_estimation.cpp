@@ -1,7 +1,11 @@
 #include <opencv2/core/types_c.h>  // cvIplImage
 #include <opencv2/imgproc/imgproc_c.h>
 
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
 #include <cmath>
+#include <stdexcept>
 #include <ctime>
 #include <opencv2/calib3d/calib3d.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
@@ -16,28 +20,210 @@ using namespace dlib;
 using namespace std;
 using namespace cv;
 
+// Tracking mode: a tracked face is considered lost if its features move by
+// more than this ratio of the face size between two frames, or if the face
+// size changes by more than this ratio.
+static const double MAX_TRACKING_MOTION=0.25;
+static const double MAX_TRACKING_SCALE_CHANGE=0.2;
+
+// Depth-based pose: minimum number of 3D facial features used to align the
+// head model, and outlier rejection (features further than
+// OUTLIER_DISTANCE_FACTOR times the median distance, and at least
+// MIN_OUTLIER_DISTANCE, from the aligned model are rejected)
+static const size_t MIN_DEPTH_POSE_POINTS=4;
+static const double MIN_OUTLIER_DISTANCE=15.; // mm
+static const double OUTLIER_DISTANCE_FACTOR=3.;
+static const int MAX_OUTLIER_REJECTION_ITERATIONS=3;
+
+// Warm-started solvePnP: if the RMS reprojection error (relative to the face
+// width) of the pose found from the previous frame's pose exceeds this value,
+// the pose is solved again from the canonical initial guess.
+static const double MAX_WARM_START_REPROJECTION_ERROR=0.05;
+
+// 3D model of the head used by solvePnP. Built once: the detected 2D points
+// passed to solvePnP must follow the same order.
+// The first NB_HEAD_POINTS are the default model, the others are only used
+// by the extended model.
+static const size_t NB_HEAD_POINTS=8;
+static const size_t NB_EXTENDED_HEAD_POINTS=15;
+static const std::array<Point3f, NB_EXTENDED_HEAD_POINTS> HEAD_POINTS = {{
+    P3D_SELLION,
+    P3D_RIGHT_EYE,
+    P3D_LEFT_EYE,
+    P3D_RIGHT_EAR,
+    P3D_LEFT_EAR,
+    P3D_MENTON,
+    P3D_NOSE,
+    P3D_STOMMION,
+
+    P3D_RIGHT_EYE_INNER,
+    P3D_LEFT_EYE_INNER,
+    P3D_RIGHT_EYEBROW,
+    P3D_LEFT_EYEBROW,
+    P3D_NOSE_BASE,
+    P3D_RIGHT_MOUTH,
+    P3D_LEFT_MOUTH
+}};
+
+// Axes of the head frame, for display
+static const std::array<Point3f, 4> HEAD_AXES = {{
+    Point3f(0,0,0),
+    Point3f(50,0,0),
+    Point3f(0,50,0),
+    Point3f(0,0,50)
+}};
+
 inline Point toCv(const dlib::point& p)
 {
     return Point(p.x(), p.y());
 }
 
+inline double elapsedMs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Bounding box of the facial features
+inline drectangle featuresBox(const full_object_detection& d)
+{
+    drectangle box;
+    for (size_t i = 0; i < d.num_parts(); ++i) {
+        if (d.part(i) == OBJECT_PART_NOT_PRESENT) continue;
+        if (box.is_empty()) box = drectangle(d.part(i), d.part(i));
+        else box += d.part(i);
+    }
+    return box;
+}
+
+// Position reported for the facial features not fitted by reduced models
+static const Point MISSING_FEATURE(-1, -1);
 
-HeadPoseEstimation::HeadPoseEstimation(const string& face_detection_model, float focalLength) :
+// 2D position of the facial feature, MISSING_FEATURE if not fitted by the model
+inline Point featureOf(const full_object_detection& d, size_t i)
+{
+    if (d.part(i) == OBJECT_PART_NOT_PRESENT) return MISSING_FEATURE;
+    return toCv(d.part(i));
+}
+
+
+HeadPoseEstimation::HeadPoseEstimation(const string& face_detection_model, float focalLength, unsigned int detectionInterval, unsigned int nbThreads) :
         focalLength(focalLength),
         opticalCenterX(-1),
-        opticalCenterY(-1)
+        opticalCenterY(-1),
+        detectionInterval(detectionInterval),
+        detectionScale(1.),
+        minFaceSize(0),
+        pnpSolver(PNP_ITERATIVE),
+        extendedHeadModel(false),
+        trackLifetime(10),
+        poseFiltering(false),
+        filterMinCutoff(1.),
+        filterBeta(0.5),
+        frames_since_detection(0),
+        frame_time(0.)
 {
     // Load face detection and pose estimation models.
-    detector = get_frontal_face_detector();
-    deserialize(face_detection_model) >> pose_model;
+    update_context.detector = FaceDetectorPtr(std::unique_ptr<FaceDetector>(new HogFaceDetector()));
+    unsigned long nb_parts;
+    if (FlatShapePredictor::isFlatModel(face_detection_model)) {
+        flat_pose_model = std::make_shared<const FlatShapePredictor>(face_detection_model);
+        nb_parts = flat_pose_model->num_parts();
+    }
+    else {
+        auto model = std::make_shared<shape_predictor>();
+        deserialize(face_detection_model) >> *model;
+        pose_model = model;
+        nb_parts = pose_model->num_parts();
+    }
+
+    if (nb_parts == NB_REDUCED_FEATURES) {
+        layout.assign(REDUCED_LAYOUT.begin(), REDUCED_LAYOUT.end());
+    }
+    else if (nb_parts != NB_FEATURES) {
+        throw std::runtime_error("Unsupported landmark model " + face_detection_model + ": " +
+                                 std::to_string(nb_parts) + " facial features (68 or " +
+                                 std::to_string(NB_REDUCED_FEATURES) + " expected)");
+    }
+
+    if (nbThreads > 1) {
+        workers = std::make_shared<dlib::thread_pool>(nbThreads);
+    }
 }
 
+void HeadPoseEstimation::forEachFace(size_t n, const std::function<void(size_t)>& f) const
+{
+    if (workers && n > 1) {
+        // one chunk per face: each face is a significant amount of work
+        parallel_for(*workers, 0, n, [&f](long i) { f(i); }, 1);
+    }
+    else {
+        for (size_t i = 0; i < n; ++i) f(i);
+    }
+}
+
+
+void HeadPoseEstimation::setFrameTime(double timestamp)
+{
+    if (timestamp < 0) {
+        timestamp = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    frame_time = timestamp;
+}
 
-std::vector<std::vector<Point>> HeadPoseEstimation::update(cv::InputArray _image)
+std::vector<std::vector<Point>> HeadPoseEstimation::update(cv::InputArray image, double timestamp)
 {
+    setFrameTime(timestamp);
+    detectAndTrack(image.getMat());
 
+    return features(shapes);
+}
+
+std::vector<std::vector<Point>> HeadPoseEstimation::update(cv::InputArray _image, const std::vector<Rect>& detected_faces, double timestamp)
+{
+    setFrameTime(timestamp);
     Mat image = _image.getMat();
+    initOpticalCenter(image);
+
+    last_timings = stage_timings();
+    last_timings.detected = true;
+
+    std::vector<dlib::rectangle> dlib_faces;
+    for (const auto& face : detected_faces) {
+        dlib_faces.push_back(dlib::rectangle(face.x, face.y, face.x + face.width - 1, face.y + face.height - 1));
+    }
+    setFaces(toGray(image, update_context.gray_image), dlib_faces);
+
+    return features(shapes);
+}
+
+void HeadPoseEstimation::setFaceDetector(std::unique_ptr<FaceDetector> face_detector)
+{
+    update_context.detector = FaceDetectorPtr(std::move(face_detector));
+    batch_contexts.clear();
+}
+
+void HeadPoseEstimation::update(cv::InputArray image, std::vector<facial_features>& all_features, double timestamp)
+{
+    setFrameTime(timestamp);
+    detectAndTrack(image.getMat());
+
+    // no allocation once all_features has reached the max number of faces
+    all_features.resize(shapes.size());
 
+    for (size_t j = 0; j < shapes.size(); ++j)
+    {
+        const full_object_detection& d = shapes[j];
+        auto& features = all_features[j];
+
+        for (size_t i = 0; i < NB_FEATURES; ++i)
+        {
+            features[i] = featureOf(d, i);
+        }
+    }
+}
+
+void HeadPoseEstimation::initOpticalCenter(const Mat& image)
+{
     if (opticalCenterX == -1) // not initialized yet
     {
         opticalCenterX = image.cols / 2;
@@ -46,30 +232,89 @@ std::vector<std::vector<Point>> HeadPoseEstimation::update(cv::InputArray _image
         cerr << "Setting the optical center to (" << opticalCenterX << ", " << opticalCenterY << ")" << endl;
 #endif
     }
+}
 
-    // intermediate value to avoid potential compilation error:
-    //     conversion from ‘const cv::Mat’ to non-scalar type ‘IplImage’
-    auto ipl_img = cvIplImage(image);
-    current_image = cv_image<bgr_pixel>(&ipl_img);
+void HeadPoseEstimation::detectAndTrack(const Mat& image)
+{
+    initOpticalCenter(image);
+
+    // the facial features are fitted on the intensity only: one conversion
+    // per frame (none for grayscale images) instead of one per face. The
+    // detector gets the original image (dlib's HOG uses color gradients).
+    Mat gray = toGray(image, update_context.gray_image);
+
+    frames_since_detection++;
+
+    last_timings = stage_timings();
+
+    bool tracked = false;
+    if (!shapes.empty() && frames_since_detection < detectionInterval) {
+        auto start = std::chrono::steady_clock::now();
+        tracked = track(gray);
+        last_timings.landmarking = elapsedMs(start);
+        if (tracked) updateIds();
+    }
+
+    if (!tracked) {
+        auto start = std::chrono::steady_clock::now();
+        auto detected_faces = detect(image);
+        last_timings.detection = elapsedMs(start);
+        last_timings.detected = true;
+
+        setFaces(gray, detected_faces);
+    }
+}
+
+void HeadPoseEstimation::setFaces(const Mat& image, const std::vector<dlib::rectangle>& detected_faces)
+{
+    faces = detected_faces;
+
+    // Find the facial features of each face.
+    auto start = std::chrono::steady_clock::now();
+    shapes = fit(image, faces);
+    last_timings.landmarking += elapsedMs(start);
+
+    initTracks();
+    updateIds();
+    frames_since_detection = 0;
+}
+
+void HeadPoseEstimation::updateIds()
+{
+    // the order of the faces returned by the detector changes between
+    // frames: the PnP states are kept by face identifier
+    for (size_t i = 0; i < face_ids.size() && i < pnp_states.size(); ++i) {
+        track_states[face_ids[i]] = pnp_states[i];
+    }
 
-    faces = detector(current_image);
+    tracker.lifetime = trackLifetime;
+    face_ids = tracker.update(faces);
 
-    // Find the pose of each face.
-    shapes.clear();
-    for (auto face : faces){
-        shapes.push_back(pose_model(current_image, face));
+    pnp_states.assign(faces.size(), pnp_state());
+    for (size_t i = 0; i < faces.size(); ++i) {
+        auto state = track_states.find(face_ids[i]);
+        if (state != track_states.end()) pnp_states[i] = state->second;
     }
 
+    // forget the faces lost for good
+    for (auto state = track_states.begin(); state != track_states.end();) {
+        if (tracker.isTracked(state->first)) ++state;
+        else state = track_states.erase(state);
+    }
+}
+
+std::vector<std::vector<Point>> HeadPoseEstimation::features(const std::vector<full_object_detection>& detected_shapes)
+{
     std::vector<std::vector<Point>> all_features;
 
-    for (size_t j = 0; j < shapes.size(); ++j)
+    for (size_t j = 0; j < detected_shapes.size(); ++j)
     {
         std::vector<Point> features;
-        const full_object_detection& d = shapes[j];
+        const full_object_detection& d = detected_shapes[j];
 
-        for (size_t i = 0; i < 68; ++i)
+        for (size_t i = 0; i < NB_FEATURES; ++i)
         {
-            features.push_back(toCv(d.part(i)));
+            features.push_back(featureOf(d, i));
         }
 
         all_features.push_back(features);
@@ -78,91 +323,679 @@ std::vector<std::vector<Point>> HeadPoseEstimation::update(cv::InputArray _image
     return all_features;
 }
 
-head_pose HeadPoseEstimation::pose(size_t face_idx) const
+std::vector<full_object_detection> HeadPoseEstimation::fit(cv::InputArray _image, const std::vector<dlib::rectangle>& detected_faces) const
 {
+    Mat buffer;
+    Mat image = toGray(_image.getMat(), buffer);
 
-    cv::Mat projectionMat = cv::Mat::zeros(3,3,CV_32F);
-    cv::Matx33f projection = projectionMat;
-    projection(0,0) = focalLength;
-    projection(1,1) = focalLength;
-    projection(0,2) = opticalCenterX;
-    projection(1,2) = opticalCenterY;
-    projection(2,2) = 1;
+    // intermediate value to avoid potential compilation error:
+    //     conversion from ‘const cv::Mat’ to non-scalar type ‘IplImage’
+    auto ipl_img = cvIplImage(image);
+    auto dlib_image = cv_image<unsigned char>(&ipl_img);
 
-    std::vector<Point3f> head_points;
+    std::vector<full_object_detection> detected_shapes(detected_faces.size());
+    forEachFace(detected_faces.size(), [&](size_t i) {
+        detected_shapes[i] = fitShape(dlib_image, detected_faces[i]);
+    });
 
-    head_points.push_back(P3D_SELLION);
-    head_points.push_back(P3D_RIGHT_EYE);
-    head_points.push_back(P3D_LEFT_EYE);
-    head_points.push_back(P3D_RIGHT_EAR);
-    head_points.push_back(P3D_LEFT_EAR);
-    head_points.push_back(P3D_MENTON);
-    head_points.push_back(P3D_NOSE);
-    head_points.push_back(P3D_STOMMION);
+    return detected_shapes;
+}
 
-    std::vector<Point2f> detected_points;
+std::vector<dlib::rectangle> HeadPoseEstimation::detect(cv::InputArray image)
+{
+    return detect(image.getMat(), *update_context.detector, update_context.detection_image);
+}
 
-    detected_points.push_back(coordsOf(face_idx, SELLION));
-    detected_points.push_back(coordsOf(face_idx, RIGHT_EYE));
-    detected_points.push_back(coordsOf(face_idx, LEFT_EYE));
-    detected_points.push_back(coordsOf(face_idx, RIGHT_SIDE));
-    detected_points.push_back(coordsOf(face_idx, LEFT_SIDE));
-    detected_points.push_back(coordsOf(face_idx, MENTON));
-    detected_points.push_back(coordsOf(face_idx, NOSE));
+std::vector<std::vector<dlib::rectangle>> HeadPoseEstimation::detect(const std::vector<Mat>& images)
+{
+    if (images.empty()) return {};
+
+    auto& detector = *update_context.detector;
+    const auto scale = detectionScaleFor(detector);
+
+    batch_buffers.resize(images.size());
+    std::vector<Mat> inputs;
+    std::vector<Rect> rois;
+    std::vector<size_t> detected; // images with a non-empty detection ROI
+    for (size_t i = 0; i < images.size(); ++i) {
+        rois.push_back(detectionRoi(images[i]));
+        if (rois.back().area() == 0) continue;
+        inputs.push_back(colorInput(detectionInput(images[i], rois.back(), scale, batch_buffers[i]), detector));
+        detected.push_back(i);
+    }
 
-    auto stomion = (coordsOf(face_idx, MOUTH_CENTER_TOP) + coordsOf(face_idx, MOUTH_CENTER_BOTTOM)) * 0.5;
-    detected_points.push_back(stomion);
+    std::vector<std::vector<dlib::rectangle>> all_detections(images.size());
+    if (inputs.empty()) return all_detections;
 
+    auto detections = detector.detect(inputs);
 
-    // Initializing the head pose 1m away, roughly facing the robot
-    // This initialization is important as it prevents solvePnP to find the
-    // mirror solution (head *behind* the camera)
-    Mat tvec = (Mat_<double>(3,1) << 0., 0., 1000.);
-    Mat rvec = (Mat_<double>(3,1) << 1.2, 1.2, -1.2);
+    for (size_t j = 0; j < detected.size(); ++j) {
+        auto i = detected[j];
+        all_detections[i] = std::move(detections[j]);
+        toImageCoordinates(all_detections[i], rois[i], scale);
+    }
+    return all_detections;
+}
 
-    // Find the 3D pose of our head
-    solvePnP(head_points, detected_points,
-            projection, noArray(),
-            rvec, tvec, true,
-#ifdef OPENCV3
-            cv::SOLVEPNP_ITERATIVE);
-#else
-            cv::ITERATIVE);
-#endif
+std::vector<dlib::rectangle> HeadPoseEstimation::detect(const Mat& image,
+                                                        FaceDetector& face_detector,
+                                                        Mat& buffer) const
+{
+    const auto roi = detectionRoi(image);
+
+    // detection ROI outside of the image
+    if (roi.area() == 0) return {};
+
+    const auto scale = detectionScaleFor(face_detector);
+
+    auto detections = face_detector.detect(colorInput(detectionInput(image, roi, scale, buffer), face_detector));
+    toImageCoordinates(detections, roi, scale);
+
+    return detections;
+}
+
+Rect HeadPoseEstimation::detectionRoi(const Mat& image) const
+{
+    auto roi = Rect(0, 0, image.cols, image.rows);
+    if (detectionROI.area() > 0) {
+        roi &= detectionROI;
+    }
+    return roi;
+}
+
+double HeadPoseEstimation::detectionScaleFor(const FaceDetector& face_detector) const
+{
+    double scale = detectionScale;
+    if (minFaceSize > 0 && face_detector.minFaceSize() > 0) {
+        scale = static_cast<double>(face_detector.minFaceSize()) / minFaceSize;
+    }
+    if (scale <= 0. || scale > 1.) scale = 1.;
+    return scale;
+}
+
+Mat HeadPoseEstimation::detectionInput(const Mat& image, const Rect& roi, double scale, Mat& buffer)
+{
+    Mat input = image(roi);
+    if (scale < 1.) {
+        cv::resize(input, buffer, Size(), scale, scale, INTER_AREA);
+        input = buffer;
+    }
+    return input;
+}
+
+Mat HeadPoseEstimation::colorInput(const Mat& input, const FaceDetector& face_detector)
+{
+    if (input.channels() == 3) return input;
+    if (input.channels() == 1 && face_detector.grayscale()) return input;
+
+    // the detectors only take BGR (or, for some, grayscale) images
+    Mat color;
+    cv::cvtColor(input, color, input.channels() == 4 ? COLOR_BGRA2BGR : COLOR_GRAY2BGR);
+    return color;
+}
+
+Mat HeadPoseEstimation::toGray(const Mat& image, Mat& buffer)
+{
+    if (image.channels() == 1) return image;
+
+    // same intensity as dlib's (mean of the channels), that the landmark
+    // models are trained with
+    if (image.channels() == 4) cv::transform(image, buffer, Matx14f(1/3.f, 1/3.f, 1/3.f, 0.f));
+    else cv::transform(image, buffer, Matx13f(1/3.f, 1/3.f, 1/3.f));
+    return buffer;
+}
+
+void HeadPoseEstimation::toImageCoordinates(std::vector<dlib::rectangle>& detections, const Rect& roi, double scale)
+{
+    // back to full resolution image coordinates
+    for (auto& face : detections) {
+        face = dlib::rectangle(static_cast<long>(roi.x + face.left() / scale),
+                               static_cast<long>(roi.y + face.top() / scale),
+                               static_cast<long>(roi.x + face.right() / scale),
+                               static_cast<long>(roi.y + face.bottom() / scale));
+    }
+}
+
+full_object_detection HeadPoseEstimation::fitShape(const cv_image<unsigned char>& image, const dlib::rectangle& face) const
+{
+    auto shape = flat_pose_model ? (*flat_pose_model)(image, face) : (*pose_model)(image, face);
+    if (layout.empty()) return shape;
+
+    // reduced model: back to the 68-point layout
+    std::vector<dlib::point> parts(NB_FEATURES, OBJECT_PART_NOT_PRESENT);
+    for (size_t i = 0; i < layout.size(); ++i) {
+        parts[layout[i]] = shape.part(i);
+    }
+    return full_object_detection(shape.get_rect(), parts);
+}
+
+head_pose_results HeadPoseEstimation::fitAndSolve(const Mat& image,
+                                                  const std::vector<dlib::rectangle>& detected_faces,
+                                                  Mat& gray_buffer) const
+{
+    head_pose_results res;
+
+    Mat gray = toGray(image, gray_buffer);
+    auto ipl_img = cvIplImage(gray);
+    auto dlib_image = cv_image<unsigned char>(&ipl_img);
+
+    std::vector<full_object_detection> detected_shapes;
+    for (const auto& face : detected_faces) {
+        detected_shapes.push_back(fitShape(dlib_image, face));
+    }
+
+    res.features = features(detected_shapes);
+    for (const auto& shape : detected_shapes) {
+        pnp_state state;
+        res.poses.push_back(pose(shape, state, image.size()));
+        res.reprojection_errors.push_back(state.error);
+    }
+    return res;
+}
+
+head_pose_results HeadPoseEstimation::estimate(cv::InputArray _image, EstimationContext& context) const
+{
+    Mat image = _image.getMat();
+    if (image.empty()) return head_pose_results();
+
+    auto detected_faces = detect(image, *context.detector, context.detection_image);
+    return fitAndSolve(image, detected_faces, context.gray_image);
+}
+
+std::vector<head_pose_results> HeadPoseEstimation::updateBatch(const std::vector<Mat>& images)
+{
+    // each image is processed independently: no tracking, no warm-start
+    std::vector<head_pose_results> results(images.size());
+
+    // Batched detectors (GPU): one detection call for all the images (of
+    // the same size), then facial features and poses on the workers.
+    if (update_context.detector->batched()) {
+        std::vector<size_t> indices;
+        std::vector<Mat> batch;
+        for (size_t i = 0; i < images.size(); ++i) {
+            if (images[i].empty()) continue;
+            indices.push_back(i);
+            batch.push_back(images[i]);
+        }
+
+        auto all_faces = detect(batch);
+
+        forEachFace(batch.size(), [&](size_t j) {
+            Mat gray_buffer;
+            results[indices[j]] = fitAndSolve(batch[j], all_faces[j], gray_buffer);
+        });
+        return results;
+    }
+
+    if (!workers) {
+        for (size_t i = 0; i < images.size(); ++i) results[i] = estimate(images[i], update_context);
+        return results;
+    }
+
+    // One context (face detector and buffers) per worker: the detector is
+    // not thread-safe. The shape predictor is only read, and shared by all
+    // the workers.
+    size_t nb_workers = workers->num_threads_in_pool();
+    while (batch_contexts.size() < nb_workers) batch_contexts.push_back(createContext());
+
+    // worker k processes images k, k + nb_workers, k + 2 * nb_workers...
+    parallel_for(*workers, 0, nb_workers, [&](long k) {
+        for (size_t i = k; i < images.size(); i += nb_workers) {
+            results[i] = estimate(images[i], batch_contexts[k]);
+        }
+    }, 1);
+
+    return results;
+}
+
+void HeadPoseEstimation::initTracks()
+{
+    tracks.clear();
+
+    for (size_t i = 0; i < shapes.size(); ++i) {
+        auto box = featuresBox(shapes[i]);
+        auto face_center = dcenter(faces[i]);
+        auto box_center = dcenter(box);
+
+        face_track t;
+        t.offset_x = (face_center.x() - box_center.x()) / box.width();
+        t.offset_y = (face_center.y() - box_center.y()) / box.height();
+        t.scale_x = faces[i].width() / box.width();
+        t.scale_y = faces[i].height() / box.height();
+        tracks.push_back(t);
+    }
+}
+
+bool HeadPoseEstimation::track(const Mat& image)
+{
+    const auto image_area = dlib::rectangle(0, 0, image.cols - 1, image.rows - 1);
+
+    std::vector<drectangle> previous_boxes;
+    std::vector<dlib::rectangle> predicted_faces;
+
+    for (size_t i = 0; i < shapes.size(); ++i) {
+        const auto& t = tracks[i];
+
+        // predict the detector's box from the previous facial features
+        auto box = featuresBox(shapes[i]);
+        auto box_center = dcenter(box);
+        auto center = dlib::dpoint(box_center.x() + t.offset_x * box.width(),
+                                   box_center.y() + t.offset_y * box.height());
+        auto face = centered_rect(dlib::point(center),
+                                  static_cast<unsigned long>(t.scale_x * box.width()),
+                                  static_cast<unsigned long>(t.scale_y * box.height()));
+
+        // face (partially) out of the image: let the detector find it again
+        if (!image_area.contains(face)) return false;
+
+        previous_boxes.push_back(box);
+        predicted_faces.push_back(face);
+    }
+
+    auto tracked_shapes = fit(image, predicted_faces);
+
+    for (size_t i = 0; i < tracked_shapes.size(); ++i) {
+        const auto& box = previous_boxes[i];
+
+        // tracking confidence: the facial features should not jump between 
+        // two consecutive frames
+        auto new_box = featuresBox(tracked_shapes[i]);
+        auto motion = length(dcenter(new_box) - dcenter(box)) / box.width();
+        auto scale_change = std::abs(new_box.width() / box.width() - 1.);
+
+        if (motion > MAX_TRACKING_MOTION ||
+            scale_change > MAX_TRACKING_SCALE_CHANGE) return false;
+    }
+
+    faces.swap(predicted_faces);
+    shapes.swap(tracked_shapes);
+    return true;
+}
+
+head_pose HeadPoseEstimation::pose(size_t face_idx) const
+{
+    // the previous pose of the face (same identifier) is used as initial
+    // guess.
+    if (face_idx < pnp_states.size()) {
+        auto& state = pnp_states[face_idx];
+        auto raw_pose = pose(shapes[face_idx], state);
+        if (!poseFiltering) return raw_pose;
+
+        state.filter.minCutoff = filterMinCutoff;
+        state.filter.beta = filterBeta;
+        return state.filter.filter(raw_pose, frame_time);
+    }
+
+    pnp_state state;
+    return pose(shapes[face_idx], state);
+}
 
+// Head pose (in meters) from solvePnP's rotation and translation (in mm)
+static head_pose toHeadPose(const Vec3d& rvec, const Vec3d& tvec)
+{
     Matx33d rotation;
     Rodrigues(rvec, rotation);
 
     head_pose pose = {
-        rotation(0,0),    rotation(0,1),    rotation(0,2),    tvec.at<double>(0)/1000,
-        rotation(1,0),    rotation(1,1),    rotation(1,2),    tvec.at<double>(1)/1000,
-        rotation(2,0),    rotation(2,1),    rotation(2,2),    tvec.at<double>(2)/1000,
+        rotation(0,0),    rotation(0,1),    rotation(0,2),    tvec(0)/1000,
+        rotation(1,0),    rotation(1,1),    rotation(1,2),    tvec(1)/1000,
+        rotation(2,0),    rotation(2,1),    rotation(2,2),    tvec(2)/1000,
                     0,                0,                0,                     1
     };
 
     return pose;
 }
 
-std::vector<head_pose> HeadPoseEstimation::poses() const {
+head_pose HeadPoseEstimation::predictedPose(size_t face_idx, double dt) const
+{
+    const auto& state = pnp_states.at(face_idx);
+
+    if (poseFiltering && state.filter.valid()) return state.filter.predict(dt);
+
+    return toHeadPose(state.rvec, state.tvec);
+}
+
+// 2D positions of the points of the head model (same order as HEAD_POINTS)
+static std::array<Point2f, NB_EXTENDED_HEAD_POINTS> headPoints2d(const full_object_detection& shape)
+{
+    auto coordsOf = [&shape](FACIAL_FEATURE feature) {
+        return Point2f(shape.part(feature).x(), shape.part(feature).y());
+    };
+
+    return {{
+        coordsOf(SELLION),
+        coordsOf(RIGHT_EYE),
+        coordsOf(LEFT_EYE),
+        coordsOf(RIGHT_SIDE),
+        coordsOf(LEFT_SIDE),
+        coordsOf(MENTON),
+        coordsOf(NOSE),
+        (coordsOf(MOUTH_CENTER_TOP) + coordsOf(MOUTH_CENTER_BOTTOM)) * 0.5, // stomion
+
+        coordsOf(RIGHT_EYE_INNER),
+        coordsOf(LEFT_EYE_INNER),
+        coordsOf(EYEBROW_RIGHT),
+        coordsOf(EYEBROW_LEFT),
+        coordsOf(NOSE_BASE),
+        coordsOf(MOUTH_RIGHT),
+        coordsOf(MOUTH_LEFT)
+    }};
+}
+
+// RMS reprojection error (in pixels) of the head model for the pose (rvec, tvec)
+static double rmsReprojectionError(const Mat& head_points,
+                                   const Mat& detected_points,
+                                   const Vec3d& rvec, const Vec3d& tvec,
+                                   const Matx33f& camera_matrix)
+{
+    std::array<Point2f, NB_EXTENDED_HEAD_POINTS> reprojected_points;
+    Mat reprojected_points_mat(head_points.rows, 1, CV_32FC2, reprojected_points.data());
+    projectPoints(head_points, rvec, tvec, camera_matrix, noArray(), reprojected_points_mat);
+
+    double sq_error = 0.;
+    for (int i = 0; i < head_points.rows; ++i) {
+        auto d = reprojected_points[i] - detected_points.at<Point2f>(i);
+        sq_error += d.dot(d);
+    }
+    return sqrt(sq_error / head_points.rows);
+}
+
+// Solves the pose with the given algorithm. rvec and tvec are used as initial
+// guess by the iterative solver.
+static void solve(PNP_SOLVER solver,
+                  const Mat& head_points,
+                  const Mat& detected_points,
+                  const Matx33f& camera_matrix,
+                  Vec3d& rvec, Vec3d& tvec)
+{
+#ifdef OPENCV3
+    switch (solver) {
+        case PNP_EPNP:
+            solvePnP(head_points, detected_points, camera_matrix, noArray(),
+                     rvec, tvec, false, cv::SOLVEPNP_EPNP);
+            break;
+        case PNP_SQPNP:
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && (CV_VERSION_MINOR > 5 || (CV_VERSION_MINOR == 5 && CV_VERSION_REVISION >= 3)))
+            solvePnP(head_points, detected_points, camera_matrix, noArray(),
+                     rvec, tvec, false, cv::SOLVEPNP_SQPNP);
+#else
+            solvePnP(head_points, detected_points, camera_matrix, noArray(),
+                     rvec, tvec, false, cv::SOLVEPNP_EPNP);
+#endif
+            break;
+        case PNP_EPNP_REFINE:
+            solvePnP(head_points, detected_points, camera_matrix, noArray(),
+                     rvec, tvec, false, cv::SOLVEPNP_EPNP);
+#if (CV_VERSION_MAJOR == 4 && CV_VERSION_MINOR >= 1) || CV_VERSION_MAJOR > 4
+            solvePnPRefineLM(head_points, detected_points, camera_matrix, noArray(),
+                             rvec, tvec, TermCriteria(TermCriteria::EPS + TermCriteria::COUNT, 5, FLT_EPSILON));
+#else
+            solvePnP(head_points, detected_points, camera_matrix, noArray(),
+                     rvec, tvec, true, cv::SOLVEPNP_ITERATIVE);
+#endif
+            break;
+        case PNP_ITERATIVE:
+        default:
+            solvePnP(head_points, detected_points, camera_matrix, noArray(),
+                     rvec, tvec, true, cv::SOLVEPNP_ITERATIVE);
+    }
+#else
+    if (solver == PNP_ITERATIVE) {
+        solvePnP(head_points, detected_points, camera_matrix, noArray(),
+                 rvec, tvec, true, cv::ITERATIVE);
+    }
+    else {
+        solvePnP(head_points, detected_points, camera_matrix, noArray(),
+                 rvec, tvec, false, cv::EPNP);
+        if (solver == PNP_EPNP_REFINE) {
+            solvePnP(head_points, detected_points, camera_matrix, noArray(),
+                     rvec, tvec, true, cv::ITERATIVE);
+        }
+    }
+#endif
+}
+
+Matx33f HeadPoseEstimation::cameraMatrix(const Size& image_size) const
+{
+    float cx = opticalCenterX, cy = opticalCenterY;
+    if (cx == -1 && image_size.area() > 0) { // not initialized
+        cx = image_size.width / 2;
+        cy = image_size.height / 2;
+    }
+
+    return Matx33f(focalLength, 0.0,         cx,
+                   0.0,         focalLength, cy,
+                   0.0,         0.0,         1.0);
+}
+
+double HeadPoseEstimation::reprojectionError(size_t face_idx) const
+{
+    return pnp_states.at(face_idx).error;
+}
+
+head_pose HeadPoseEstimation::pose(const full_object_detection& shape) const
+{
+    pnp_state state;
+    return pose(shape, state);
+}
+
+head_pose HeadPoseEstimation::pose(const full_object_detection& shape, pnp_state& state, const Size& image_size) const
+{
+    const size_t nb_points = extendedHeadModel ? NB_EXTENDED_HEAD_POINTS : NB_HEAD_POINTS;
+    const auto camera = cameraMatrix(image_size);
+
+    // All the buffers are on the stack, and passed to OpenCV as Mat headers:
+    // no heap allocation on our side.
+    const Mat head_points(nb_points, 1, CV_32FC3, const_cast<Point3f*>(HEAD_POINTS.data()));
+
+    auto detected_points = headPoints2d(shape);
+    const Mat detected_points_mat(nb_points, 1, CV_32FC2, detected_points.data());
+
+    // Initializing the head pose 1m away, roughly facing the robot
+    // This initialization is important as it prevents solvePnP to find the
+    // mirror solution (head *behind* the camera)
+    static const Vec3d canonical_tvec(0., 0., 1000.);
+    static const Vec3d canonical_rvec(1.2, 1.2, -1.2);
+
+    // On video, the previous pose of the face is a much better initial guess
+    // for the iterative solver: fewer Levenberg-Marquardt iterations, and no
+    // flip to the mirror solution.
+    const bool warm_start = state.valid && pnpSolver == PNP_ITERATIVE;
+
+    Vec3d tvec = warm_start ? state.tvec : canonical_tvec;
+    Vec3d rvec = warm_start ? state.rvec : canonical_rvec;
+
+    // Find the 3D pose of our head
+    solve(pnpSolver, head_points, detected_points_mat, camera, rvec, tvec);
+
+    auto face_width = cv::norm(coordsOf(shape, LEFT_SIDE) - coordsOf(shape, RIGHT_SIDE));
+    auto error = rmsReprojectionError(head_points, detected_points_mat, rvec, tvec, camera);
+
+    if (warm_start && (tvec(2) <= 0 || error > MAX_WARM_START_REPROJECTION_ERROR * face_width)) {
+        // bad fit: back to the canonical initialization
+        tvec = canonical_tvec;
+        rvec = canonical_rvec;
+        solve(pnpSolver, head_points, detected_points_mat, camera, rvec, tvec);
+        error = rmsReprojectionError(head_points, detected_points_mat, rvec, tvec, camera);
+    }
+
+    state.valid = true;
+    state.rvec = rvec;
+    state.tvec = tvec;
+    state.error = error;
+
+    return toHeadPose(rvec, tvec);
+}
+
+// Rigid transformation (rotation, translation) that best maps the model
+// points onto the observed ones (least squares, Kabsch algorithm)
+static void rigidAlignment(const std::vector<Vec3d>& model,
+                           const std::vector<Vec3d>& observed,
+                           Matx33d& rotation, Vec3d& translation)
+{
+    Vec3d model_centroid, observed_centroid;
+    for (size_t i = 0; i < model.size(); ++i) {
+        model_centroid += model[i];
+        observed_centroid += observed[i];
+    }
+    model_centroid *= 1. / model.size();
+    observed_centroid *= 1. / observed.size();
+
+    Matx33d covariance;
+    for (size_t i = 0; i < model.size(); ++i) {
+        covariance += (model[i] - model_centroid) * (observed[i] - observed_centroid).t();
+    }
+
+    Matx31d w;
+    Matx33d u, vt;
+    SVD::compute(covariance, w, u, vt);
+
+    // no reflection
+    auto d = determinant(vt.t() * u.t()) < 0 ? -1. : 1.;
+    rotation = vt.t() * Matx33d::diag(Vec3d(1., 1., d)) * u.t();
+    translation = observed_centroid - rotation * model_centroid;
+}
+
+bool HeadPoseEstimation::depthPose(size_t face_idx, const std::vector<Point3f>& features3d, head_pose& result, bool refine) const
+{
+    if (features3d.size() != NB_FEATURES) return false;
+
+    const size_t nb_points = extendedHeadModel ? NB_EXTENDED_HEAD_POINTS : NB_HEAD_POINTS;
+
+    // 3D positions of the points of the head model, in mm (NaN if unknown)
+    auto at = [&features3d](FACIAL_FEATURE feature) {
+        const auto& p = features3d[feature];
+        return Vec3d(p.x, p.y, p.z) * 1000.;
+    };
+    const std::array<Vec3d, NB_EXTENDED_HEAD_POINTS> observed = {{
+        at(SELLION),
+        at(RIGHT_EYE),
+        at(LEFT_EYE),
+        at(RIGHT_SIDE),
+        at(LEFT_SIDE),
+        at(MENTON),
+        at(NOSE),
+        (at(MOUTH_CENTER_TOP) + at(MOUTH_CENTER_BOTTOM)) * 0.5, // stomion
+
+        at(RIGHT_EYE_INNER),
+        at(LEFT_EYE_INNER),
+        at(EYEBROW_RIGHT),
+        at(EYEBROW_LEFT),
+        at(NOSE_BASE),
+        at(MOUTH_RIGHT),
+        at(MOUTH_LEFT)
+    }};
+
+    std::vector<size_t> inliers;
+    for (size_t i = 0; i < nb_points; ++i) {
+        if (cvIsNaN(observed[i][0]) || cvIsNaN(observed[i][1]) || cvIsNaN(observed[i][2])) continue;
+        inliers.push_back(i);
+    }
+
+    Matx33d rotation;
+    Vec3d tvec;
+
+    for (int iteration = 0; ; ++iteration) {
+        if (inliers.size() < MIN_DEPTH_POSE_POINTS) return false;
+
+        std::vector<Vec3d> model_points, observed_points;
+        for (auto i : inliers) {
+            model_points.push_back(Vec3d(HEAD_POINTS[i].x, HEAD_POINTS[i].y, HEAD_POINTS[i].z));
+            observed_points.push_back(observed[i]);
+        }
+        rigidAlignment(model_points, observed_points, rotation, tvec);
+
+        if (iteration == MAX_OUTLIER_REJECTION_ITERATIONS) break;
 
-    std::vector<head_pose> res;
+        std::vector<double> distances;
+        for (size_t j = 0; j < inliers.size(); ++j) {
+            distances.push_back(cv::norm(rotation * model_points[j] + tvec - observed_points[j]));
+        }
+        auto sorted = distances;
+        std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+        auto threshold = std::max(MIN_OUTLIER_DISTANCE, OUTLIER_DISTANCE_FACTOR * sorted[sorted.size() / 2]);
 
-    for (auto i = 0; i < faces.size(); i++){
-        res.push_back(pose(i));
+        std::vector<size_t> new_inliers;
+        for (size_t j = 0; j < inliers.size(); ++j) {
+            if (distances[j] <= threshold) new_inliers.push_back(inliers[j]);
+        }
+        if (new_inliers.size() == inliers.size()) break;
+        inliers.swap(new_inliers);
     }
 
+    Vec3d rvec;
+    Rodrigues(rotation, rvec);
+
+    const Mat head_points(nb_points, 1, CV_32FC3, const_cast<Point3f*>(HEAD_POINTS.data()));
+    auto detected_points = headPoints2d(shapes.at(face_idx));
+    const Mat detected_points_mat(nb_points, 1, CV_32FC2, detected_points.data());
+
+    if (refine) {
+        solve(PNP_ITERATIVE, head_points, detected_points_mat, cameraMatrix(), rvec, tvec);
+    }
+
+    pnp_state local_state;
+    auto& state = face_idx < pnp_states.size() ? pnp_states[face_idx] : local_state;
+    state.valid = true;
+    state.rvec = rvec;
+    state.tvec = tvec;
+    state.error = rmsReprojectionError(head_points, detected_points_mat, rvec, tvec, cameraMatrix());
+
+    result = toHeadPose(rvec, tvec);
+    if (poseFiltering) {
+        state.filter.minCutoff = filterMinCutoff;
+        state.filter.beta = filterBeta;
+        result = state.filter.filter(result, frame_time);
+    }
+
+    return true;
+}
+
+std::vector<head_pose> HeadPoseEstimation::poses() const {
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<head_pose> res(shapes.size());
+
+    // each face only accesses its own PnP state
+    forEachFace(shapes.size(), [this, &res](size_t i) {
+        res[i] = pose(i);
+    });
+
+    last_timings.pnp = elapsedMs(start);
+    return res;
+
+}
+
+
+std::vector<head_pose> HeadPoseEstimation::poses(const std::vector<full_object_detection>& detected_shapes,
+                                                 std::vector<double>* reprojection_errors) const {
+
+    std::vector<head_pose> res(detected_shapes.size());
+    if (reprojection_errors) reprojection_errors->resize(detected_shapes.size());
+
+    forEachFace(detected_shapes.size(), [this, &res, &detected_shapes, reprojection_errors](size_t i) {
+        pnp_state state;
+        res[i] = pose(detected_shapes[i], state);
+        if (reprojection_errors) (*reprojection_errors)[i] = state.error;
+    });
+
     return res;
 
 }
 
 Mat HeadPoseEstimation::drawDetections(const cv::Mat& original_image, const std::vector<std::vector<Point>>& detected_features, const std::vector<head_pose>& detected_poses) {
-    auto result = original_image.clone();
+    Mat result;
+    if (original_image.channels() == 1) cv::cvtColor(original_image, result, COLOR_GRAY2BGR);
+    else if (original_image.channels() == 4) cv::cvtColor(original_image, result, COLOR_BGRA2BGR);
+    else result = original_image.clone();
+
     if (!detected_features.empty()) {
         drawFeatures(detected_features, result);
     }
     for (size_t i = 0; i < detected_poses.size(); ++i)
     {
-        drawPose(detected_poses[i], i, result);
+        drawPose(detected_poses[i], result);
     }
     return result;
 }
@@ -176,35 +1009,47 @@ void HeadPoseEstimation::drawFeatures(const std::vector<std::vector<Point>>& det
     {
         const auto& feature_points = detected_features[j];
 
+        // features not fitted by reduced models are at (-1, -1)
+        auto link = [&result](const Point& p1, const Point& p2) {
+            if (p1 == MISSING_FEATURE || p2 == MISSING_FEATURE) return;
+            cv::line(result, p1, p2, line_color, 2, CV_AA);
+        };
+
+        if (!layout.empty()) {
+            for (auto idx : layout) {
+                cv::circle(result, feature_points[idx], 2, line_color, 2, CV_AA);
+            }
+        }
+
         for (size_t i = 1; i <= 16; ++i)
-            cv::line(result, feature_points[i], feature_points[i-1], line_color, 2, CV_AA);
+            link(feature_points[i], feature_points[i-1]);
 
         for (size_t i = 28; i <= 30; ++i)
-            cv::line(result, feature_points[i], feature_points[i-1], line_color, 2, CV_AA);
+            link(feature_points[i], feature_points[i-1]);
 
         for (size_t i = 18; i <= 21; ++i)
-            cv::line(result, feature_points[i], feature_points[i-1], line_color, 2, CV_AA);
+            link(feature_points[i], feature_points[i-1]);
         for (size_t i = 23; i <= 26; ++i)
-            cv::line(result, feature_points[i], feature_points[i-1], line_color, 2, CV_AA);
+            link(feature_points[i], feature_points[i-1]);
         for (size_t i = 31; i <= 35; ++i)
-            cv::line(result, feature_points[i], feature_points[i-1], line_color, 2, CV_AA);
-        cv::line(result, feature_points[30], feature_points[35], line_color, 2, CV_AA);
+            link(feature_points[i], feature_points[i-1]);
+        link(feature_points[30], feature_points[35]);
 
         for (size_t i = 37; i <= 41; ++i)
-            cv::line(result, feature_points[i], feature_points[i-1], line_color, 2, CV_AA);
-        cv::line(result, feature_points[36], feature_points[41], line_color, 2, CV_AA);
+            link(feature_points[i], feature_points[i-1]);
+        link(feature_points[36], feature_points[41]);
 
         for (size_t i = 43; i <= 47; ++i)
-            cv::line(result, feature_points[i], feature_points[i-1], line_color, 2, CV_AA);
-        cv::line(result, feature_points[42], feature_points[47], line_color, 2, CV_AA);
+            link(feature_points[i], feature_points[i-1]);
+        link(feature_points[42], feature_points[47]);
 
         for (size_t i = 49; i <= 59; ++i)
-            cv::line(result, feature_points[i], feature_points[i-1], line_color, 2, CV_AA);
-        cv::line(result, feature_points[48], feature_points[59], line_color, 2, CV_AA);
+            link(feature_points[i], feature_points[i-1]);
+        link(feature_points[48], feature_points[59]);
 
         for (size_t i = 61; i <= 67; ++i)
-            cv::line(result, feature_points[i], feature_points[i-1], line_color, 2, CV_AA);
-        cv::line(result, feature_points[60], feature_points[67], line_color, 2, CV_AA);
+            link(feature_points[i], feature_points[i-1]);
+        link(feature_points[60], feature_points[67]);
 
         // for (size_t i = 0; i < 68 ; i++) {
             // putText(result, to_string(i), feature_points[i], FONT_HERSHEY_DUPLEX, 0.6, text_color);
@@ -212,46 +1057,27 @@ void HeadPoseEstimation::drawFeatures(const std::vector<std::vector<Point>>& det
     }
 }
 
-void HeadPoseEstimation::drawPose(const head_pose& detected_pose, size_t face_idx, cv::Mat& result) const {
+void HeadPoseEstimation::drawPose(const head_pose& detected_pose, cv::Mat& result) const {
     const auto rotation = Mat(detected_pose)(Range(0, 3), Range(0, 3));
     auto rvec = Mat_<double>(3, 1);
     Rodrigues(rotation, rvec);
 
     auto tvec = Mat(detected_pose).col(3).rowRange(0, 3);
 
-    
-    cv::Matx33f projection(focalLength, 0.0,         opticalCenterX,
-                           0.0,         focalLength, opticalCenterY,
-                           0.0,         0.0,         1.0);
-
-    
-    std::vector<Point3f> head_points;
-
-    head_points.push_back(P3D_SELLION);
-    head_points.push_back(P3D_RIGHT_EYE);
-    head_points.push_back(P3D_LEFT_EYE);
-    head_points.push_back(P3D_RIGHT_EAR);
-    head_points.push_back(P3D_LEFT_EAR);
-    head_points.push_back(P3D_MENTON);
-    head_points.push_back(P3D_NOSE);
-    head_points.push_back(P3D_STOMMION);
-
     // std::vector<Point2f> reprojected_points;
-    // projectPoints(head_points, rvec, tvec, projection, noArray(), reprojected_points);
+    // projectPoints(Mat(NB_HEAD_POINTS, 1, CV_32FC3, const_cast<Point3f*>(HEAD_POINTS.data())), rvec, tvec, cameraMatrix(), noArray(), reprojected_points);
  
     // static const auto circle_color = Scalar(0, 255, 255);
     // for (auto point : reprojected_points) {
         // circle(result, point,2, circle_color,2);
     // }
 
-    std::vector<Point3f> axes;
-    axes.push_back(Point3f(0,0,0));
-    axes.push_back(Point3f(50,0,0));
-    axes.push_back(Point3f(0,50,0));
-    axes.push_back(Point3f(0,0,50));
+    const Mat axes(HEAD_AXES.size(), 1, CV_32FC3, const_cast<Point3f*>(HEAD_AXES.data()));
 
+    // same intrinsics as the pose estimation (image center if opticalCenterX
+    // is not set: the estimator that computed the pose might not be this one)
     std::vector<Point2f> projected_axes;
-    projectPoints(axes, rvec, tvec, projection, noArray(), projected_axes);
+    projectPoints(axes, rvec, tvec, cameraMatrix(result.size()), noArray(), projected_axes);
 
     static const auto x_axis_color = Scalar(255, 0, 0);
     static const auto y_axis_color = Scalar(0, 255, 0);
@@ -260,13 +1086,14 @@ void HeadPoseEstimation::drawPose(const head_pose& detected_pose, size_t face_id
     cv::line(result, projected_axes[0], projected_axes[2], y_axis_color,2,CV_AA);
     cv::line(result, projected_axes[0], projected_axes[1], z_axis_color,2,CV_AA);
 
+    // the origin of the head frame is the sellion
     static const auto text_color = Scalar(0,0,255);
-    putText(result, "(" + to_string(int(detected_pose(0,3) * 100)) + "cm, " + to_string(int(detected_pose(1,3) * 100)) + "cm, " + to_string(int(detected_pose(2,3) * 100)) + "cm)", coordsOf(face_idx, SELLION), FONT_HERSHEY_SIMPLEX, 0.5, text_color,2);
+    putText(result, "(" + to_string(int(detected_pose(0,3) * 100)) + "cm, " + to_string(int(detected_pose(1,3) * 100)) + "cm, " + to_string(int(detected_pose(2,3) * 100)) + "cm)", projected_axes[0], FONT_HERSHEY_SIMPLEX, 0.5, text_color,2);
 }
 
-Point2f HeadPoseEstimation::coordsOf(size_t face_idx, FACIAL_FEATURE feature) const
+Point2f HeadPoseEstimation::coordsOf(const full_object_detection& shape, FACIAL_FEATURE feature) const
 {
-    return toCv(shapes[face_idx].part(feature));
+    return toCv(shape.part(feature));
 }
 
 // Finds the intersection of two lines, or returns false.
@@ -5,10 +5,19 @@
 #include <dlib/opencv.h>
 #include <dlib/image_processing.h>
 #include <dlib/image_processing/frontal_face_detector.h>
+#include <dlib/threads.h>
+
+#include "face_detector.hpp"
+#include "face_tracker.hpp"
+#include "flat_shape_predictor.hpp"
+#include "pose_filter.hpp"
 
 #include <vector>
+#include <map>
 #include <array>
 #include <string>
+#include <memory>
+#include <functional>
 
 
 // ****** Anthorpometrics of the head ******
@@ -28,6 +37,15 @@ const static cv::Point3f P3D_LEFT_EAR(-100., 77.5,-6.);
 const static cv::Point3f P3D_NOSE(21.0, 0., -48.0);
 const static cv::Point3f P3D_STOMMION(10.0, 0., -75.0);
 const static cv::Point3f P3D_MENTON(0., 0.,-133.0);
+// Additional points of the extended head model. Rough estimates, based on
+// the usual facial proportions.
+const static cv::Point3f P3D_RIGHT_EYE_INNER(-10., -20.,-5.);
+const static cv::Point3f P3D_LEFT_EYE_INNER(-10., 20.,-5.);
+const static cv::Point3f P3D_RIGHT_EYEBROW(-5., -15.,10.);
+const static cv::Point3f P3D_LEFT_EYEBROW(-5., 15.,10.);
+const static cv::Point3f P3D_NOSE_BASE(10., 0.,-62.);
+const static cv::Point3f P3D_RIGHT_MOUTH(0., -25.,-75.);
+const static cv::Point3f P3D_LEFT_MOUTH(0., 25.,-75.);
 #endif
 // Anthropometrics for children (8 year old), taken from https://math.nist.gov/~SRessler/anthrokids/
 // (US survey from 1977)
@@ -43,6 +61,15 @@ const static cv::Point3f P3D_LEFT_EAR(-89., 58,-6.);
 const static cv::Point3f P3D_NOSE(15.0, 0., -31.0);
 const static cv::Point3f P3D_STOMMION(1., 0., -62.0);
 const static cv::Point3f P3D_MENTON(-5., 0.,-93.0);
+// Additional points of the extended head model. Rough estimates, based on
+// the usual facial proportions.
+const static cv::Point3f P3D_RIGHT_EYE_INNER(-12., -12.,-1.);
+const static cv::Point3f P3D_LEFT_EYE_INNER(-12., 12.,-1.);
+const static cv::Point3f P3D_RIGHT_EYEBROW(-5., -10.,8.);
+const static cv::Point3f P3D_LEFT_EYEBROW(-5., 10.,8.);
+const static cv::Point3f P3D_NOSE_BASE(7., 0.,-40.);
+const static cv::Point3f P3D_RIGHT_MOUTH(-5., -20.,-62.);
+const static cv::Point3f P3D_LEFT_MOUTH(-5., 20.,-62.);
 #endif
 
 //*************************************
@@ -55,7 +82,10 @@ static const int MAX_FEATURES_TO_TRACK=100;
 // Interesting facial features with their landmark index
 enum FACIAL_FEATURE {
     NOSE=30,
+    NOSE_BASE=33,
     RIGHT_EYE=36,
+    RIGHT_EYE_INNER=39,
+    LEFT_EYE_INNER=42,
     LEFT_EYE=45,
     RIGHT_SIDE=0,
     LEFT_SIDE=16,
@@ -71,24 +101,267 @@ enum FACIAL_FEATURE {
     MENTON=8
 };
 
+// Layout of the reduced landmark models: they only fit the facial features
+// used to estimate the head pose (including the extended head model). Part i
+// of a reduced model is the facial feature REDUCED_LAYOUT[i] of the 68-point
+// model.
+static const size_t NB_REDUCED_FEATURES=16;
+static const std::array<FACIAL_FEATURE, NB_REDUCED_FEATURES> REDUCED_LAYOUT = {{
+    SELLION,
+    RIGHT_EYE,
+    LEFT_EYE,
+    RIGHT_SIDE,
+    LEFT_SIDE,
+    MENTON,
+    NOSE,
+    MOUTH_CENTER_TOP,
+    MOUTH_CENTER_BOTTOM,
+    RIGHT_EYE_INNER,
+    LEFT_EYE_INNER,
+    EYEBROW_RIGHT,
+    EYEBROW_LEFT,
+    NOSE_BASE,
+    MOUTH_RIGHT,
+    MOUTH_LEFT
+}};
+
 
 typedef cv::Matx44d head_pose;
 
+// Algorithm used to solve the Perspective-n-Point problem. From slowest and
+// most accurate to fastest:
+//  - PNP_ITERATIVE: Levenberg-Marquardt, warm-started from the previous pose
+//  - PNP_EPNP_REFINE: EPnP, followed by a few Levenberg-Marquardt iterations
+//  - PNP_SQPNP: SQPnP (OpenCV >= 4.5.3, EPnP otherwise)
+//  - PNP_EPNP: EPnP (closed-form)
+enum PNP_SOLVER {
+    PNP_ITERATIVE,
+    PNP_EPNP_REFINE,
+    PNP_SQPNP,
+    PNP_EPNP
+};
+
+static const size_t NB_FEATURES=68;
+
+// 2D positions of the 68 facial features of one face
+typedef std::array<cv::Point2f, NB_FEATURES> facial_features;
+
+// Facial features and head poses found in one image
+struct head_pose_results {
+    std::vector<std::vector<cv::Point>> features;
+    std::vector<head_pose> poses;
+    std::vector<double> reprojection_errors;
+};
+
+// Duration (in milliseconds) of the processing stages of the last
+// update()/poses()
+struct stage_timings {
+    bool detected = false;    // false if the faces were tracked
+    double detection = 0.;    // full-frame face detection (0 if tracked)
+    double landmarking = 0.;  // facial features fitting (incl. tracking)
+    double pnp = 0.;          // head pose estimation of all the faces
+};
+
+/** Per-thread working state of a HeadPoseEstimation: a copy of the face
+ * detector (detectors are not thread-safe) and the image buffers reused from
+ * one frame to the next. Cheap: the models are not copied.
+ *
+ * Copying a context clones its detector, but not its buffers.
+ */
+class EstimationContext {
+
+public:
+
+    EstimationContext() = default;
+
+    EstimationContext(const EstimationContext& other) :
+        detector(other.detector) {}
+
+    EstimationContext& operator=(const EstimationContext& other) {
+        detector = other.detector;
+        detection_image = cv::Mat();
+        gray_image = cv::Mat();
+        return *this;
+    }
+
+    EstimationContext(EstimationContext&&) = default;
+    EstimationContext& operator=(EstimationContext&&) = default;
+
+private:
+    friend class HeadPoseEstimation;
+
+    explicit EstimationContext(const FaceDetectorPtr& detector) :
+        detector(detector) {}
+
+    FaceDetectorPtr detector;
+
+    // downscaled image for the face detector, and grayscale image for the
+    // facial features
+    cv::Mat detection_image;
+    cv::Mat gray_image;
+};
+
 class HeadPoseEstimation {
 
 public:
 
-    HeadPoseEstimation(const std::string& face_detection_model = "shape_predictor_68_face_landmarks.dat", float focalLength=455.);
+    /** face_detection_model is either a dlib shape predictor model, or a
+     * model converted to the memory-mapped flat format by gazr_convert_model
+     * (detected automatically). Both 68-point models and reduced models (see
+     * REDUCED_LAYOUT, and gazr_train_reduced_model) are supported.
+     *
+     * If nbThreads > 1, the facial features and the head poses of the
+     * detected faces are computed in parallel on a pool of nbThreads workers.
+     */
+    HeadPoseEstimation(const std::string& face_detection_model = "shape_predictor_68_face_landmarks.dat", float focalLength=455., unsigned int detectionInterval=1, unsigned int nbThreads=1);
 
     /** Returns the 2D position (in image coordinates) of the 68 facial features
      * detected by dlib (or an empty vector if no face is detected).
+     *
+     * With a reduced landmark model, the features that are not fitted by the
+     * model are set to (-1, -1).
+     *
+     * If detectionInterval > 1, the full-frame face detector only runs every
+     * detectionInterval frames (or when tracking is lost): in between, the
+     * facial features are fitted in boxes predicted from the previous frame.
+     *
+     * timestamp (in seconds) is the acquisition time of the image, used by
+     * the pose filter. If < 0, the time of the call is used.
+     *
+     * The image is either BGR (or BGRA), or 8-bit grayscale, eg the luma
+     * plane of a YUV frame. The facial features only depend on the
+     * intensity: grayscale images are used as is, without any conversion or
+     * copy, and color images are converted once per frame (instead of once
+     * per face). Grayscale images are converted to BGR only for the color
+     * face detectors (CNN, OpenCV DNN), and BGRA images to BGR for all the
+     * detectors, after downscaling.
      */
-    std::vector<std::vector<cv::Point>> update(cv::InputArray image);
+    std::vector<std::vector<cv::Point>> update(cv::InputArray image, double timestamp = -1);
 
+    /** Same as above, but writes the facial features in a caller-owned
+     * buffer (one contiguous array of 68 points per face), that is only
+     * reallocated when more faces than ever before are detected.
+     *
+     * Note that dlib's shape predictor returns integer pixel coordinates.
+     */
+    void update(cv::InputArray image, std::vector<facial_features>& all_features, double timestamp = -1);
+
+    /** Same as update(image), with faces found by an external (upstream)
+     * detector, in image coordinates: the face detector is not used.
+     *
+     * The facial features are fitted more accurately if the boxes are
+     * similar to dlib's (square, from the eyebrows to the chin).
+     */
+    std::vector<std::vector<cv::Point>> update(cv::InputArray image, const std::vector<cv::Rect>& detected_faces, double timestamp = -1);
+
+    /** Replaces the face detector (dlib's HOG detector by default), for
+     * instance by a CnnFaceDetector or an OpenCvDnnFaceDetector.
+     */
+    void setFaceDetector(std::unique_ptr<FaceDetector> face_detector);
+
+    /** Head pose of the face face_idx of the last update(), filtered if
+     * poseFiltering is true.
+     */
     head_pose pose(size_t face_idx) const;
 
     std::vector<head_pose> poses() const;
 
+    /** Filtered pose of the face face_idx, extrapolated dt seconds after the
+     * last update() (eg to compensate for the processing latency), from the
+     * head velocity estimated by the pose filter. Must be called after
+     * pose(face_idx)/poses(). Without poseFiltering, the pose is not
+     * extrapolated.
+     */
+    head_pose predictedPose(size_t face_idx, double dt) const;
+
+    /** Head pose of the face face_idx of the last update(), computed by rigid
+     * 3D-3D alignment (Kabsch) of the head model to the 3D positions of
+     * the facial features, eg measured on a registered depth image.
+     *
+     * features3d holds the 3D position (in the camera frame, in meters) of
+     * the 68 facial features, NaN if unknown. Features too far from the
+     * aligned model (typically, where the depth image sees the background)
+     * are rejected iteratively. If refine is true, the pose is then refined
+     * by PnP on the 2D facial features.
+     *
+     * Returns false (and leaves pose untouched) if too few facial features
+     * have a valid 3D position: use pose(face_idx) instead.
+     */
+    bool depthPose(size_t face_idx, const std::vector<cv::Point3f>& features3d, head_pose& pose, bool refine = false) const;
+
+    /** Persistent identifier of the face face_idx of the last update(): a
+     * face keeps its identifier as long as it is tracked (see FaceTracker),
+     * whereas its index depends on the order of the detector's output.
+     */
+    unsigned long faceId(size_t face_idx) const {return face_ids.at(face_idx);}
+    const std::vector<unsigned long>& faceIds() const {return face_ids;}
+
+    /*  Lower-level building blocks of update() and poses(). They neither
+     *  depend on nor modify the faces currently tracked by the estimator, and
+     *  can be used to run the processing stages in different threads:
+     *  detect() must only be called from one thread at a time, but fit() and
+     *  pose() can run concurrently with it.
+     */
+
+    /** Returns the faces detected in the (downscaled) region of interest of
+     * the image, in full resolution image coordinates.
+     */
+    std::vector<dlib::rectangle> detect(cv::InputArray image);
+
+    /** Detects the faces in several images at once, in a single call to the
+     * face detector: with a batched detector (CnnFaceDetector), the images
+     * (typically from several cameras) are processed in one GPU inference.
+     * The results can be passed to fit() and poses() as usual.
+     */
+    std::vector<std::vector<dlib::rectangle>> detect(const std::vector<cv::Mat>& images);
+
+    /** Returns the facial features fitted in each of the given faces. Color
+     * images are converted to grayscale first (pass a grayscale image to
+     * avoid doing it for each call).
+     */
+    std::vector<dlib::full_object_detection> fit(cv::InputArray image, const std::vector<dlib::rectangle>& detected_faces) const;
+
+    head_pose pose(const dlib::full_object_detection& shape) const;
+
+    /** If reprojection_errors is not null, it is filled with the RMS
+     * reprojection error of each pose.
+     */
+    std::vector<head_pose> poses(const std::vector<dlib::full_object_detection>& detected_shapes,
+                                 std::vector<double>* reprojection_errors = nullptr) const;
+
+    /** Converts dlib's facial features to the 2D positions returned by update()
+     */
+    static std::vector<std::vector<cv::Point>> features(const std::vector<dlib::full_object_detection>& detected_shapes);
+
+    /** Processes a batch of independent images (typically, for offline
+     * processing of recorded sessions), in parallel if the estimator has
+     * been created with nbThreads > 1. The results are in the same order as
+     * the input images.
+     *
+     * The images are processed independently (no tracking between images)
+     * and the tracked faces of the estimator are neither used nor modified.
+     */
+    std::vector<head_pose_results> updateBatch(const std::vector<cv::Mat>& images);
+
+    /** Stateless estimation: detects the faces of the image, and returns
+     * their facial features and head poses (unfiltered), computed on the
+     * calling thread.
+     *
+     * estimate() neither uses nor modifies the state of update() (tracked
+     * faces, poses, timings): it can be called concurrently on the same
+     * estimator from several threads, each with its own context (see
+     * createContext()), as long as the settings of the estimator are not
+     * modified meanwhile. If the optical center is not set, the center of the
+     * image is used.
+     */
+    head_pose_results estimate(cv::InputArray image, EstimationContext& context) const;
+
+    /** Returns a new context for estimate(), with a copy of the current face
+     * detector (contexts created before setFaceDetector() keep the previous
+     * detector).
+     */
+    EstimationContext createContext() const {return EstimationContext(update_context.detector);}
+
     /** Returns an augmented image with the detected facial features and head pose drawn in.
      * 
      * Leave either detected_features or detected_poses empty to skip drawing the respective detections.
@@ -99,25 +372,196 @@ public:
     float opticalCenterX;
     float opticalCenterY;
 
+    // run the face detector every detectionInterval frames (1: every frame)
+    unsigned int detectionInterval;
+
+    // Face detection is performed on a copy of the image downscaled by
+    // detectionScale (<= 1). Alternatively, if minFaceSize > 0, the scale is
+    // computed so that faces of minFaceSize pixels (in the full resolution
+    // image) are the smallest that can be detected.
+    // The facial features are always fitted on the full resolution image.
+    float detectionScale;
+    unsigned int minFaceSize;
+
+    // if not empty, faces are only detected in this region of the image (no
+    // face is detected if it lies outside of the image)
+    cv::Rect detectionROI;
+
+    PNP_SOLVER pnpSolver;
+
+    // if true, 15 facial features (instead of 8) are used to solve the pose:
+    // more accurate, but slower
+    bool extendedHeadModel;
+
+    // number of frames a face that is not detected anymore keeps its
+    // identifier (and its previous pose), in case it reappears
+    unsigned int trackLifetime;
+
+    // Temporal filtering of the head poses returned by pose()/poses(), per
+    // face (see PoseFilter): cutoff frequency (in Hz) when the head is
+    // still, and increase of the cutoff frequency with the head speed (lower
+    // values: smoother, but more lag)
+    bool poseFiltering;
+    float filterMinCutoff;
+    float filterBeta;
+
+    /** RMS reprojection error (in pixels) of the head model, for the pose of
+     * face face_idx computed by the last call to pose(face_idx)/poses().
+     * Can be used as a confidence measure of the pose.
+     */
+    double reprojectionError(size_t face_idx) const;
+
+    /** Timings of the last update() and poses() (measured with a monotonic
+     * clock). Not updated by the lower-level building blocks.
+     */
+    const stage_timings& timings() const {return last_timings;}
+
 private:
 
-    dlib::cv_image<dlib::bgr_pixel> current_image;
+    // face detector and buffers used by update() (the detector is cloned
+    // when the estimator is copied; the buffers are not shared)
+    EstimationContext update_context;
+
+    // facial features model: either dlib's shape predictor, or a
+    // memory-mapped flat model (see flat_shape_predictor.hpp). Immutable, and
+    // shared between copies of the estimator.
+    std::shared_ptr<const dlib::shape_predictor> pose_model;
+    std::shared_ptr<const FlatShapePredictor> flat_pose_model;
+
+    // for reduced landmark models, index in the 68-point model of each part
+    // of the model (empty for 68-point models)
+    std::vector<unsigned long> layout;
 
-    dlib::frontal_face_detector detector;
-    dlib::shape_predictor pose_model;
+    /** Fits the facial features, always returned as a 68-point shape: parts
+     * not fitted by a reduced model are OBJECT_PART_NOT_PRESENT.
+     */
+    dlib::full_object_detection fitShape(const dlib::cv_image<unsigned char>& image, const dlib::rectangle& face) const;
+
+    /** Facial features and head poses of the given faces, without any
+     * tracking nor warm-start (used by estimate() and updateBatch()).
+     */
+    head_pose_results fitAndSolve(const cv::Mat& image,
+                                  const std::vector<dlib::rectangle>& detected_faces,
+                                  cv::Mat& gray_buffer) const;
+
+    /** Returns image if it is grayscale already, or its grayscale version,
+     * written in buffer.
+     */
+    static cv::Mat toGray(const cv::Mat& image, cv::Mat& buffer);
 
     std::vector<dlib::rectangle> faces;
 
     std::vector<dlib::full_object_detection> shapes;
 
+    // worker pool for per-face processing (null if single-threaded). Shared
+    // between copies of the estimator.
+    std::shared_ptr<dlib::thread_pool> workers;
+
+    /** Calls f(i) for i in [0, n), in parallel if a worker pool is available.
+     */
+    void forEachFace(size_t n, const std::function<void(size_t)>& f) const;
+
+    // contexts of the workers of updateBatch(), and detection buffers of
+    // the batched detect(images)
+    std::vector<EstimationContext> batch_contexts;
+    std::vector<cv::Mat> batch_buffers;
+
+    std::vector<dlib::rectangle> detect(const cv::Mat& image,
+                                        FaceDetector& face_detector,
+                                        cv::Mat& buffer) const;
+
+    // region of the image, and scale, actually processed by the detector
+    cv::Rect detectionRoi(const cv::Mat& image) const;
+    double detectionScaleFor(const FaceDetector& face_detector) const;
+    static cv::Mat detectionInput(const cv::Mat& image, const cv::Rect& roi, double scale, cv::Mat& buffer);
+
+    // converts BGRA detection inputs to BGR, and grayscale ones to BGR for
+    // the color detectors
+    static cv::Mat colorInput(const cv::Mat& input, const FaceDetector& face_detector);
+    static void toImageCoordinates(std::vector<dlib::rectangle>& detections, const cv::Rect& roi, double scale);
+
+    // Tracking mode: geometry of the detector's box relative to the bounding
+    // box of the facial features, measured on the last keyframe. Used to
+    // predict where the detector would have placed the face in the next frame.
+    struct face_track {
+        double offset_x, offset_y; // box center offset, in feature box widths/heights
+        double scale_x, scale_y;   // box size, in feature box widths/heights
+    };
+
+    std::vector<face_track> tracks;
+    unsigned int frames_since_detection;
+
+    // mutable: the pnp timing is set by the (const) poses()
+    mutable stage_timings last_timings;
+
+    /** Fits the facial features of the faces found in the previous frame in
+     * boxes predicted from their previous position. Returns false (and leaves
+     * faces/shapes untouched) if any of the face is lost.
+     */
+    bool track(const cv::Mat& image);
+
+    /** Finds the faces and their facial features in the image, either by
+     * running the face detector, or by tracking the previous faces.
+     */
+    void detectAndTrack(const cv::Mat& image);
+
+    /** Fits the facial features of newly detected faces, and starts
+     * tracking them.
+     */
+    void setFaces(const cv::Mat& image, const std::vector<dlib::rectangle>& detected_faces);
+
+    void initOpticalCenter(const cv::Mat& image);
+
+    void initTracks();
+
+
+    // Warm-start of solvePnP: pose of each face found at the previous update()
+    struct pnp_state {
+        bool valid = false;
+        cv::Vec3d rvec, tvec;
+        double error = 0.; // RMS reprojection error, in pixels
+
+        // temporal filter of the face pose (only used by pose(face_idx))
+        PoseFilter filter;
+    };
+
+    // acquisition time (in seconds) of the last update()'s image
+    double frame_time;
+    void setFrameTime(double timestamp);
+
+    // mutable: updated by the (const) pose(face_idx), each face only
+    // accessing its own slot.
+    mutable std::vector<pnp_state> pnp_states;
+
+    /** Solves the head pose, using (and updating) the given PnP state.
+     * image_size is only used if the optical center is not set.
+     */
+    head_pose pose(const dlib::full_object_detection& shape, pnp_state& state, const cv::Size& image_size = cv::Size()) const;
+
+    // Face identities: identifier of each face, and last PnP state of all
+    // the faces known to the tracker (including the ones lost recently)
+    FaceTracker tracker;
+    std::vector<unsigned long> face_ids;
+    std::map<unsigned long, pnp_state> track_states;
+
+    /** Associates the current faces to the previous ones, and moves the
+     * PnP states (warm-start) accordingly.
+     */
+    void updateIds();
+
+    /** Returns the camera intrinsics, built from focalLength and opticalCenter{X,Y}.
+     * (a Matx on the stack: cheaper than checking a cache, and thread-safe)
+     * If the optical center is not set, the center of image_size is used.
+     */
+    cv::Matx33f cameraMatrix(const cv::Size& image_size = cv::Size()) const;
 
     void drawFeatures(const std::vector<std::vector<cv::Point>>& detected_features, cv::Mat& result) const;
 
-    void drawPose(const head_pose& detected_pose, size_t face_idx, cv::Mat& result) const;
+    void drawPose(const head_pose& detected_pose, cv::Mat& result) const;
 
     /** Return the point corresponding to the dictionary marker.
     */
-    cv::Point2f coordsOf(size_t face_idx, FACIAL_FEATURE feature) const;
+    cv::Point2f coordsOf(const dlib::full_object_detection& shape, FACIAL_FEATURE feature) const;
 
     /** Returns true if the lines intersect (and set r to the intersection
      *  coordinates), false otherwise.
@@ -0,0 +1,90 @@
+#ifndef __LATEST_WINS_QUEUE
+#define __LATEST_WINS_QUEUE
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+/** A bounded, thread-safe FIFO queue that drops its *oldest* item when a new
+ * item is pushed while the queue is full: consumers always get the latest
+ * items, and slow consumers never block the producers.
+ */
+template<typename T>
+class LatestWinsQueue {
+
+public:
+
+    LatestWinsQueue(size_t capacity = 1) :
+        capacity(capacity),
+        nb_dropped(0),
+        closed(false) {}
+
+    /** Pushes item. Returns false if an older item had to be dropped.
+     */
+    bool push(T item) {
+        bool dropped = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (items.size() >= capacity) {
+                items.pop_front();
+                nb_dropped++;
+                dropped = true;
+            }
+            items.push_back(std::move(item));
+        }
+        not_empty.notify_one();
+        return !dropped;
+    }
+
+    /** Waits for an item. Returns false if the queue has been closed.
+     */
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [this]() {return !items.empty() || closed;});
+        if (closed) return false;
+
+        item = std::move(items.front());
+        items.pop_front();
+        return true;
+    }
+
+    /** Returns immediately: false if no item is available.
+     */
+    bool tryPop(T& item) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.empty() || closed) return false;
+
+        item = std::move(items.front());
+        items.pop_front();
+        return true;
+    }
+
+    /** Wakes up all the waiting consumers. pop() returns false from now on.
+     */
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        not_empty.notify_all();
+    }
+
+    /** Number of items dropped since the creation of the queue.
+     */
+    size_t dropped() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return nb_dropped;
+    }
+
+private:
+
+    const size_t capacity;
+    size_t nb_dropped;
+    bool closed;
+
+    std::deque<T> items;
+    mutable std::mutex mutex;
+    std::condition_variable not_empty;
+};
+
+#endif // __LATEST_WINS_QUEUE
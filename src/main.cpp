@@ -1,8 +1,12 @@
+#include <algorithm>
 #include <string>
+#include <vector>
 #include <ros/ros.h>
 
 #include "ros_head_pose_estimator.hpp"
 #include "facialfeaturescloud.hpp"
+#include "multi_camera_estimator.hpp"
+#include "ros_parameters.hpp"
 
 using namespace std;
 
@@ -23,6 +27,19 @@ int main(int argc, char* argv[])
     bool enableDepth;
     _private_node.param<bool>("with_depth", enableDepth, false);
 
+    EstimatorParameters params;
+    params.load(_private_node);
+
+    // multi-camera mode: list of camera namespaces, and (optionally) the TF
+    // prefix of each camera
+    vector<string> cameras, prefixes;
+    _private_node.param("cameras", cameras, cameras);
+    _private_node.param("prefixes", prefixes, prefixes);
+    string cameraImageTopic;
+    // same default as the single-camera nodes' 'rgb' topic, but relative to
+    // each camera namespace (no remapping possible)
+    _private_node.param<string>("camera_image", cameraImageTopic, "rgb");
+
     if (modelFilename.empty()) {
         ROS_ERROR_STREAM("You must provide the face model with the parameter face_model.\n" <<
                          "For instance, _face_model:=shape_predictor_68_face_landmarks.dat");
@@ -31,19 +48,47 @@ int main(int argc, char* argv[])
 
     // initialize the detector by subscribing to the camera video stream
     ROS_INFO_STREAM("Initializing the face detector with the model " << modelFilename <<"...");
-    if(!enableDepth) {
-        HeadPoseEstimator estimator(rosNode, prefix, modelFilename);
+    if(!cameras.empty()) {
+        if (enableDepth) {
+            ROS_WARN("The multi-camera mode is RGB-only: the depth streams are ignored");
+        }
+        if (params.lazy) {
+            ROS_WARN("The lazy mode is not supported in multi-camera mode: the cameras are always subscribed");
+        }
+        if (params.maxFps > 0 || params.cpuBudget > 0) {
+            ROS_WARN("The compute budget (max_fps, cpu_budget) is not supported in multi-camera mode: ignored");
+        }
+
+        if (prefixes.size() != cameras.size()) {
+            // default: <prefix>_<camera namespace> (faces published as
+            // <prefix>_<camera namespace>_<id>)
+            prefixes.clear();
+            for (auto camera : cameras) {
+                replace(camera.begin(), camera.end(), '/', '_');
+                camera.erase(0, camera.find_first_not_of('_'));
+                prefixes.push_back(prefix + "_" + camera);
+            }
+        }
+
+        MultiCameraEstimator estimator(rosNode, cameras, prefixes, cameraImageTopic, modelFilename, params);
+        ROS_INFO_STREAM("Multi-camera estimator successfully initialized (" << cameras.size() << " cameras)." << endl <<
+                        "TF frames of detected faces will be published as <camera prefix>_<face id>," << endl <<
+                        "the faces and their number on <camera namespace>/gazr/detected_faces(/count).");
+        ros::spin();
+    }
+    else if(!enableDepth) {
+        HeadPoseEstimator estimator(rosNode, prefix, modelFilename, params);
         ROS_INFO_STREAM("RGB-only estimator successfully initialized." << endl <<
-                        "TF frames of detected faces will be published when detected," << endl <<
-                        "as well as the nb of detected faces on /nb_detected_faces.");
+                        "TF frames of detected faces will be published as " << prefix << "_<face id>," << endl <<
+                        "the faces and their number on /gazr/detected_faces(/count).");
         ros::spin();
     }
     else {
-        FacialFeaturesPointCloudPublisher estimator(rosNode, prefix, modelFilename);
+        FacialFeaturesPointCloudPublisher estimator(rosNode, prefix, modelFilename, params);
         ROS_INFO_STREAM("RGB-D estimator successfully initialized." << endl <<
-                        "TF frames of detected faces will be published when detected," << endl <<
-                        "point clouds of 3D facial features will be made available on /facial_features," << endl <<
-                        "the nb of detected faces will be published on /nb_detected_faces.");
+                        "TF frames of detected faces will be published as " << prefix << "_<face id>," << endl <<
+                        "point clouds of 3D facial features will be made available on /gazr/facial_features," << endl <<
+                        "the faces and their number on /gazr/detected_faces(/count).");
         ros::spin();
     }
 
@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <chrono>
+
+#include <cv_bridge/cv_bridge.h>
+
+#include "multi_camera_estimator.hpp"
+#include "ros_image.hpp"
+
+using namespace std;
+using namespace cv;
+
+MultiCameraEstimator::Camera::Camera(ros::NodeHandle& rosNode,
+                                     const string& name,
+                                     const string& prefix,
+                                     const HeadPoseEstimation& estimator,
+                                     const EstimatorParameters& params) :
+    name(name),
+    facePrefix(prefix),
+    node(rosNode, name),
+    it(node),
+    faces(prefix, params.maxReprojectionError, params.publishTf),
+    stats(node, "gazr: " + prefix),
+    estimator(estimator) // shares the model, clones the face detector
+{
+    faces.advertise(node);
+}
+
+MultiCameraEstimator::MultiCameraEstimator(ros::NodeHandle& rosNode,
+                                           const vector<string>& camera_names,
+                                           const vector<string>& prefixes,
+                                           const string& imageTopic,
+                                           const string& modelFilename,
+                                           const EstimatorParameters& params) :
+    posePrediction(params.poseFiltering ? params.posePrediction : 0.)
+{
+    // the models are only loaded once. The per-camera estimators are
+    // single-threaded: the parallelism comes from processing several
+    // cameras at the same time.
+    HeadPoseEstimation prototype(modelFilename, 455., params.detectionInterval, 1);
+    params.apply(prototype);
+
+    for (size_t i = 0; i < camera_names.size(); ++i) {
+        cameras.emplace_back(new Camera(rosNode, camera_names[i], prefixes[i], prototype, params));
+    }
+
+    size_t nb_workers = std::max(params.nbThreads, 1u);
+    for (size_t i = 0; i < nb_workers; ++i) {
+        workers.emplace_back(&MultiCameraEstimator::work, this);
+    }
+
+    for (size_t i = 0; i < cameras.size(); ++i) {
+        cameras[i]->sub = cameras[i]->it.subscribeCamera(imageTopic, 1,
+                [this, i](const sensor_msgs::ImageConstPtr& msg, const sensor_msgs::CameraInfoConstPtr& camerainfo) {
+                    queueFrame(i, msg, camerainfo);
+                });
+        ROS_INFO_STREAM("Camera " << camera_names[i] << ": faces published as " << prefixes[i] << "_<id>");
+    }
+}
+
+MultiCameraEstimator::~MultiCameraEstimator()
+{
+    for (auto& camera : cameras) camera->sub.shutdown();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    frame_available.notify_all();
+
+    for (auto& worker : workers) worker.join();
+}
+
+void MultiCameraEstimator::queueFrame(size_t camera_idx,
+                                      const sensor_msgs::ImageConstPtr& msg,
+                                      const sensor_msgs::CameraInfoConstPtr& camerainfo)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& camera = *cameras[camera_idx];
+
+        // latest frame wins
+        if (camera.pending_msg) {
+            camera.dropped++;
+            ROS_DEBUG_STREAM("Camera " << camera.name << ": dropping a frame (" << camera.dropped << " so far)");
+        }
+        camera.pending_msg = msg;
+        camera.pending_camerainfo = camerainfo;
+    }
+    frame_available.notify_one();
+}
+
+void MultiCameraEstimator::work()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true) {
+
+        // next camera (in round-robin order) with a pending frame, and not
+        // already being processed by another worker
+        Camera* camera = nullptr;
+        frame_available.wait(lock, [this, &camera]() {
+            if (stopping) return true;
+            for (size_t n = 0; n < cameras.size(); ++n) {
+                auto idx = (next_camera + n) % cameras.size();
+                if (cameras[idx]->pending_msg && !cameras[idx]->busy) {
+                    camera = cameras[idx].get();
+                    next_camera = idx + 1;
+                    return true;
+                }
+            }
+            return false;
+        });
+        if (stopping) return;
+
+        auto msg = std::move(camera->pending_msg);
+        auto camerainfo = std::move(camera->pending_camerainfo);
+        camera->pending_msg.reset();
+        camera->pending_camerainfo.reset();
+        camera->busy = true;
+
+        lock.unlock();
+        process(*camera, msg, camerainfo);
+        lock.lock();
+
+        camera->busy = false;
+
+        // a new frame of this camera might have been waiting for us
+        if (camera->pending_msg) frame_available.notify_one();
+    }
+}
+
+void MultiCameraEstimator::process(Camera& camera,
+                                   const sensor_msgs::ImageConstPtr& rgb_msg,
+                                   const sensor_msgs::CameraInfoConstPtr& camerainfo)
+{
+    ROS_INFO_STREAM_ONCE("First RGB image received (camera " << camera.name << ")");
+
+    // updating the camera model is cheap if not modified
+    camera.cameramodel.fromCameraInfo(camerainfo);
+
+    auto& estimator = camera.estimator;
+    estimator.focalLength = camera.cameramodel.fx();
+    estimator.opticalCenterX = camera.cameramodel.cx();
+    estimator.opticalCenterY = camera.cameramodel.cy();
+
+    auto rgb = estimatorImage(rgb_msg)->image;
+
+    // got an empty image!
+    if (rgb.size().area() == 0) return;
+
+    estimator.update(rgb, rgb_msg->header.stamp.toSec());
+
+    // if only the number of faces is wanted, the head poses are not computed
+    std::vector<head_pose> poses;
+    if (camera.faces.posesWanted()) poses = estimator.poses();
+
+    auto start = std::chrono::steady_clock::now();
+
+    vector<double> reprojection_errors;
+    for (size_t i = 0; i < poses.size(); ++i) {
+        reprojection_errors.push_back(estimator.reprojectionError(i));
+        if (posePrediction > 0) poses[i] = estimator.predictedPose(i, posePrediction);
+    }
+
+    // same timestamp as the frame (or later, if extrapolated)
+    std_msgs::Header faces_header;
+    faces_header.stamp = rgb_msg->header.stamp + ros::Duration(posePrediction);
+    faces_header.frame_id = camera.cameramodel.tfFrame();
+
+    camera.faces.publish(faces_header, estimator.faceIds().size(), poses, reprojection_errors, estimator.faceIds());
+
+    auto publishing = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    camera.stats.record(rgb_msg->header, estimator.timings(), publishing);
+}
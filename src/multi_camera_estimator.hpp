@@ -0,0 +1,100 @@
+#ifndef __MULTI_CAMERA_ESTIMATOR
+#define __MULTI_CAMERA_ESTIMATOR
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "head_pose_estimation.hpp"
+#include "ros_faces.hpp"
+#include "ros_parameters.hpp"
+#include "ros_stats.hpp"
+
+// ROS
+#include <ros/ros.h>
+#include <image_transport/image_transport.h>
+#include <image_geometry/pinhole_camera_model.h>
+
+/** Estimates the head poses of the faces seen by several (RGB) cameras, in
+ * a single process.
+ *
+ * The landmark model is loaded once and shared (read-only) by the per-camera
+ * estimators. The frames of all the cameras are processed by a common pool
+ * of workers: each camera only keeps its latest frame (older frames are
+ * dropped), and the workers serve the cameras in round-robin order, so a
+ * high frame-rate camera can not starve the others. The frames of a given
+ * camera are processed in order, by one worker at a time (tracking between
+ * frames is preserved).
+ *
+ * Each camera is subscribed in its own namespace (<ns>/<imageTopic>, and the
+ * camera_info topic next to it), and its faces are published as TF frames
+ * <prefix>_<id> (id: persistent identifier of the face, see FaceTracker),
+ * with one prefix per camera, and on <ns>/gazr/detected_faces.
+ */
+class MultiCameraEstimator
+{
+public:
+
+    MultiCameraEstimator(ros::NodeHandle& rosNode,
+                         const std::vector<std::string>& cameras,
+                         const std::vector<std::string>& prefixes,
+                         const std::string& imageTopic,
+                         const std::string& modelFilename,
+                         const EstimatorParameters& params = EstimatorParameters());
+
+    ~MultiCameraEstimator();
+
+private:
+
+    struct Camera {
+        Camera(ros::NodeHandle& node, const std::string& name, const std::string& prefix,
+               const HeadPoseEstimation& estimator, const EstimatorParameters& params);
+
+        std::string name;
+        std::string facePrefix;
+
+        ros::NodeHandle node;
+        image_transport::ImageTransport it;
+        image_transport::CameraSubscriber sub;
+        FacesPublisher faces;
+        StatsPublisher stats;
+
+        HeadPoseEstimation estimator;
+        image_geometry::PinholeCameraModel cameramodel;
+
+        // latest frame not processed yet (protected by the scheduler's mutex)
+        sensor_msgs::ImageConstPtr pending_msg;
+        sensor_msgs::CameraInfoConstPtr pending_camerainfo;
+        bool busy = false;
+        size_t dropped = 0;
+    };
+
+    std::vector<std::unique_ptr<Camera>> cameras;
+
+    // the poses are published that many seconds in the future (extrapolated)
+    double posePrediction;
+
+    // Scheduling
+    /////////////////////////////////////////////////////////
+    std::mutex mutex;
+    std::condition_variable frame_available;
+    bool stopping = false;
+    size_t next_camera = 0; // round-robin cursor
+
+    std::vector<std::thread> workers;
+
+    void queueFrame(size_t camera_idx,
+                    const sensor_msgs::ImageConstPtr& msg,
+                    const sensor_msgs::CameraInfoConstPtr& camerainfo);
+
+    void work();
+
+    void process(Camera& camera,
+                 const sensor_msgs::ImageConstPtr& msg,
+                 const sensor_msgs::CameraInfoConstPtr& camerainfo);
+};
+
+#endif // __MULTI_CAMERA_ESTIMATOR
@@ -0,0 +1,74 @@
+#include <memory>
+#include <string>
+
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+
+#include "ros_head_pose_estimator.hpp"
+#include "facialfeaturescloud.hpp"
+#include "ros_parameters.hpp"
+
+namespace gazr {
+
+/** Loads the face model and the tuning parameters from the nodelet's private
+ * namespace. Returns false if no face model is provided.
+ */
+bool loadParameters(const ros::NodeHandle& private_node,
+                    std::string& modelFilename,
+                    std::string& prefix,
+                    EstimatorParameters& params)
+{
+    private_node.param<std::string>("face_model", modelFilename, "");
+    private_node.param<std::string>("prefix", prefix, "face");
+    params.load(private_node);
+
+    if (modelFilename.empty()) {
+        ROS_ERROR_STREAM("You must provide the face model with the parameter face_model.\n" <<
+                         "For instance, _face_model:=shape_predictor_68_face_landmarks.dat");
+        return false;
+    }
+    return true;
+}
+
+/** Nodelet version of the RGB-only 'estimate' node. When loaded in the same
+ * nodelet manager as the camera driver, images are received as shared
+ * pointers, without serialization nor copy.
+ */
+class HeadPoseEstimatorNodelet : public nodelet::Nodelet
+{
+    std::unique_ptr<HeadPoseEstimator> estimator;
+
+    virtual void onInit()
+    {
+        std::string modelFilename, prefix;
+        EstimatorParameters params;
+        if (!loadParameters(getPrivateNodeHandle(), modelFilename, prefix, params)) return;
+
+        NODELET_INFO_STREAM("Initializing the face detector with the model " << modelFilename <<"...");
+        estimator.reset(new HeadPoseEstimator(getNodeHandle(), prefix, modelFilename, params));
+        NODELET_INFO("RGB-only estimator successfully initialized.");
+    }
+};
+
+/** Nodelet version of the RGB-D 'estimate' node (with_depth:=true)
+ */
+class FacialFeaturesPointCloudNodelet : public nodelet::Nodelet
+{
+    std::unique_ptr<FacialFeaturesPointCloudPublisher> estimator;
+
+    virtual void onInit()
+    {
+        std::string modelFilename, prefix;
+        EstimatorParameters params;
+        if (!loadParameters(getPrivateNodeHandle(), modelFilename, prefix, params)) return;
+
+        NODELET_INFO_STREAM("Initializing the face detector with the model " << modelFilename <<"...");
+        estimator.reset(new FacialFeaturesPointCloudPublisher(getNodeHandle(), prefix, modelFilename, params));
+        NODELET_INFO("RGB-D estimator successfully initialized.");
+    }
+};
+
+} // namespace gazr
+
+PLUGINLIB_EXPORT_CLASS(gazr::HeadPoseEstimatorNodelet, nodelet::Nodelet)
+PLUGINLIB_EXPORT_CLASS(gazr::FacialFeaturesPointCloudNodelet, nodelet::Nodelet)
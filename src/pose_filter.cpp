@@ -0,0 +1,93 @@
+#include <cmath>
+
+#include <opencv2/calib3d/calib3d.hpp>
+
+#include "pose_filter.hpp"
+
+using namespace cv;
+
+// Smoothing factor of an exponential filter with the given cutoff frequency
+static double smoothingFactor(double cutoff, double dt)
+{
+    auto tau = 1. / (2. * CV_PI * cutoff);
+    return 1. / (1. + tau / dt);
+}
+
+static Matx33d toRotation(const Vec3d& rvec)
+{
+    Matx33d r;
+    Rodrigues(rvec, r);
+    return r;
+}
+
+static Vec3d toRotationVector(const Matx33d& r)
+{
+    Vec3d rvec;
+    Rodrigues(r, rvec);
+    return rvec;
+}
+
+double OneEuroFilter::filter(double x, double dt)
+{
+    if (!initialized) {
+        x_hat = x;
+        dx_hat = 0.;
+        initialized = true;
+        return x_hat;
+    }
+    if (dt <= 0.) return x_hat;
+
+    dx_hat += smoothingFactor(dCutoff, dt) * ((x - x_hat) / dt - dx_hat);
+
+    auto cutoff = minCutoff + beta * std::abs(dx_hat);
+    x_hat += smoothingFactor(cutoff, dt) * (x - x_hat);
+
+    return x_hat;
+}
+
+Matx44d PoseFilter::filter(const Matx44d& pose, double timestamp)
+{
+    const Matx33d measured_rotation = pose.get_minor<3, 3>(0, 0);
+
+    double dt = timestamp - last_timestamp;
+
+    if (!initialized) {
+        rotation = measured_rotation;
+        angular_velocity = Vec3d(0., 0., 0.);
+        dt = 0.;
+    }
+    else if (dt <= 0.) {
+        return predict(0.);
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        position[i].minCutoff = minCutoff;
+        position[i].beta = beta;
+        position[i].filter(pose(i, 3), dt);
+    }
+
+    if (initialized) {
+        // rotation from the filtered orientation to the measured one
+        auto delta = toRotationVector(rotation.t() * measured_rotation);
+
+        angular_velocity += smoothingFactor(1., dt) * (delta * (1. / dt) - angular_velocity);
+
+        auto cutoff = minCutoff + beta * norm(angular_velocity);
+        rotation = rotation * toRotation(delta * smoothingFactor(cutoff, dt));
+    }
+
+    initialized = true;
+    last_timestamp = timestamp;
+
+    return predict(0.);
+}
+
+Matx44d PoseFilter::predict(double dt) const
+{
+    auto r = rotation * toRotation(angular_velocity * dt);
+
+    return Matx44d(r(0,0), r(0,1), r(0,2), position[0].value() + position[0].derivative() * dt,
+                   r(1,0), r(1,1), r(1,2), position[1].value() + position[1].derivative() * dt,
+                   r(2,0), r(2,1), r(2,2), position[2].value() + position[2].derivative() * dt,
+                        0,      0,      0,                                                    1);
+}
@@ -0,0 +1,80 @@
+#ifndef __POSE_FILTER
+#define __POSE_FILTER
+
+#include <opencv2/core/core.hpp>
+
+/** One-Euro filter (Casiez et al., CHI 2012): a first-order low-pass filter
+ * whose cutoff frequency increases with the speed of the signal: strong
+ * smoothing when the signal is (almost) still, low lag when it moves fast.
+ */
+class OneEuroFilter {
+
+public:
+
+    /** minCutoff (Hz): cutoff frequency at null speed. beta: increase of the
+     * cutoff frequency with speed. dCutoff (Hz): cutoff frequency of the
+     * speed estimation.
+     */
+    OneEuroFilter(double minCutoff = 1., double beta = 0., double dCutoff = 1.) :
+        minCutoff(minCutoff),
+        beta(beta),
+        dCutoff(dCutoff) {}
+
+    /** Filters a new sample, dt seconds after the previous one.
+     */
+    double filter(double x, double dt);
+
+    double value() const {return x_hat;}
+    double derivative() const {return dx_hat;}
+
+    double minCutoff, beta, dCutoff;
+
+private:
+    bool initialized = false;
+    double x_hat = 0., dx_hat = 0.;
+};
+
+/** Temporal filter of the head pose of one face (cv::Matx44d, ie a
+ * head_pose): One-Euro filter of the position (in meters), and of the
+ * orientation, interpolated on the rotation group (like a quaternion slerp)
+ * with a cutoff frequency depending on the angular speed.
+ *
+ * The filter also estimates the linear and angular velocities of the head,
+ * used to extrapolate the pose (predict()).
+ */
+class PoseFilter {
+
+public:
+
+    PoseFilter(double minCutoff = 1., double beta = 0.5) :
+        minCutoff(minCutoff),
+        beta(beta) {}
+
+    /** Filters the pose measured at time timestamp (in seconds), and returns
+     * the filtered pose. Poses with the same timestamp as the previous one
+     * are ignored.
+     */
+    cv::Matx44d filter(const cv::Matx44d& pose, double timestamp);
+
+    /** Returns the filtered pose extrapolated dt seconds after the last
+     * filtered pose, assuming constant linear and angular velocities.
+     */
+    cv::Matx44d predict(double dt) const;
+
+    bool valid() const {return initialized;}
+
+    // cutoff frequency (Hz) at null speed, and increase of the cutoff
+    // frequency with the speed (m/s or rad/s)
+    double minCutoff, beta;
+
+private:
+    bool initialized = false;
+    double last_timestamp = 0.;
+
+    OneEuroFilter position[3];
+
+    cv::Matx33d rotation;
+    cv::Vec3d angular_velocity; // rad/s, in the head frame
+};
+
+#endif // __POSE_FILTER
@@ -0,0 +1,137 @@
+#include <cstring>
+#include <stdexcept>
+
+#include "pose_record.hpp"
+
+using namespace std;
+
+static const char POSE_RECORD_MAGIC[8] = {'G', 'A', 'Z', 'R', 'P', 'O', 'S', '\0'};
+
+// size of the fields of a version 1 record
+static const size_t RECORD_SIZE = sizeof(double) + sizeof(uint64_t) + sizeof(float) +
+                                  NB_FEATURES * 2 * sizeof(float) + 16 * sizeof(float);
+
+// allows to pipe records between tools without a 'flush' per frame
+static const size_t WRITE_BUFFER_SIZE = 1 << 20;
+
+template<typename T>
+static char* put(char* buffer, const T& value)
+{
+    memcpy(buffer, &value, sizeof(T));
+    return buffer + sizeof(T);
+}
+
+template<typename T>
+static const char* get(const char* buffer, T& value)
+{
+    memcpy(&value, buffer, sizeof(T));
+    return buffer + sizeof(T);
+}
+
+PoseRecordWriter::PoseRecordWriter(const string& filename) :
+    file(filename == "-" ? stdout : fopen(filename.c_str(), "wb")),
+    owned(filename != "-"),
+    filename(filename == "-" ? "the standard output" : filename)
+{
+    if (!file) throw std::runtime_error("Can not open " + filename + " for writing");
+
+    setvbuf(file, nullptr, _IOFBF, WRITE_BUFFER_SIZE);
+
+    failed = fwrite(POSE_RECORD_MAGIC, sizeof(POSE_RECORD_MAGIC), 1, file) != 1 ||
+             fwrite(&POSE_RECORD_VERSION, sizeof(POSE_RECORD_VERSION), 1, file) != 1;
+}
+
+PoseRecordWriter::~PoseRecordWriter()
+{
+    if (!file) return;
+
+    if (owned) fclose(file);
+    else fflush(file);
+}
+
+void PoseRecordWriter::write(const pose_record& record)
+{
+    char buffer[sizeof(uint32_t) + RECORD_SIZE];
+
+    auto p = put(buffer, static_cast<uint32_t>(RECORD_SIZE));
+    p = put(p, record.timestamp);
+    p = put(p, record.face_id);
+    p = put(p, record.reprojection_error);
+    for (const auto& landmark : record.landmarks) {
+        p = put(p, landmark.x);
+        p = put(p, landmark.y);
+    }
+    for (int i = 0; i < 16; ++i) p = put(p, static_cast<float>(record.pose.val[i]));
+
+    if (fwrite(buffer, sizeof(buffer), 1, file) != 1) failed = true;
+}
+
+void PoseRecordWriter::flush()
+{
+    if (fflush(file) != 0) failed = true;
+    if (failed) throw std::runtime_error("Error writing the pose records to " + filename);
+}
+
+void PoseRecordWriter::close()
+{
+    if (!file) return;
+
+    if (fflush(file) != 0) failed = true;
+    if (owned && fclose(file) != 0) failed = true;
+    file = nullptr;
+
+    if (failed) throw std::runtime_error("Error writing the pose records to " + filename);
+}
+
+PoseRecordReader::PoseRecordReader(const string& filename) :
+    file(filename == "-" ? stdin : fopen(filename.c_str(), "rb")),
+    owned(filename != "-")
+{
+    if (!file) throw std::runtime_error("Can not open " + filename);
+
+    char magic[sizeof(POSE_RECORD_MAGIC)];
+    uint32_t version;
+    if (fread(magic, sizeof(magic), 1, file) != 1 ||
+        memcmp(magic, POSE_RECORD_MAGIC, sizeof(magic)) != 0 ||
+        fread(&version, sizeof(version), 1, file) != 1) {
+        if (owned) fclose(file);
+        throw std::runtime_error(filename + " is not a gazr pose record stream");
+    }
+
+    if (version != POSE_RECORD_VERSION) {
+        if (owned) fclose(file);
+        throw std::runtime_error(filename + ": unsupported pose record version " + to_string(version) +
+                                 " (version " + to_string(POSE_RECORD_VERSION) + " expected)");
+    }
+}
+
+PoseRecordReader::~PoseRecordReader()
+{
+    if (owned) fclose(file);
+}
+
+bool PoseRecordReader::next(pose_record& record)
+{
+    uint32_t length;
+    if (fread(&length, sizeof(length), 1, file) != 1) return false;
+
+    if (length < RECORD_SIZE) throw std::runtime_error("Invalid pose record");
+
+    buffer.resize(length);
+    if (fread(buffer.data(), length, 1, file) != 1) throw std::runtime_error("Truncated pose record stream");
+
+    auto p = get(buffer.data(), record.timestamp);
+    p = get(p, record.face_id);
+    p = get(p, record.reprojection_error);
+    for (auto& landmark : record.landmarks) {
+        p = get(p, landmark.x);
+        p = get(p, landmark.y);
+    }
+    for (int i = 0; i < 16; ++i) {
+        float value;
+        p = get(p, value);
+        record.pose.val[i] = value;
+    }
+
+    return true;
+}
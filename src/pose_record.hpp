@@ -0,0 +1,100 @@
+#ifndef __POSE_RECORD
+#define __POSE_RECORD
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "head_pose_estimation.hpp"
+
+/** Head pose and facial features of one face, in one frame.
+ */
+struct pose_record {
+    double timestamp = 0.;          // seconds
+    uint64_t face_id = 0;           // see HeadPoseEstimation::faceId()
+    float reprojection_error = 0.;  // pixels (lower is more confident)
+    facial_features landmarks;      // (-1, -1) if not fitted
+    head_pose pose;                 // in meters
+};
+
+/** Compact binary stream of pose_records, for offline processing of long
+ * videos (much more compact, and faster to write and parse, than text).
+ *
+ * Stream layout (native endianness):
+ *  - header: "GAZRPOS\0", uint32 version
+ *  - records: uint32 length (in bytes, of the rest of the record), then
+ *    float64 timestamp, uint64 face id, float32 reprojection error,
+ *    float32[68 * 2] landmarks, float32[16] pose (row-major, meters).
+ *
+ * Readers skip the bytes of a record beyond the fields they know: fields
+ * can be appended to the records without changing the version. The version
+ * is only bumped for incompatible changes, and readers reject the versions
+ * they do not know.
+ */
+static const uint32_t POSE_RECORD_VERSION = 1;
+
+/** Buffered writer of pose records, to a file or, if filename is "-", to
+ * the standard output.
+ */
+class PoseRecordWriter {
+
+public:
+
+    explicit PoseRecordWriter(const std::string& filename);
+    ~PoseRecordWriter();
+
+    PoseRecordWriter(const PoseRecordWriter&) = delete;
+    PoseRecordWriter& operator=(const PoseRecordWriter&) = delete;
+
+    /** Buffered: write errors are only detected when the buffer is
+     * written (see good()), and reported by flush() and close().
+     */
+    void write(const pose_record& record);
+
+    /** Throws std::runtime_error if a write failed (eg full disk).
+     */
+    void flush();
+
+    /** Flushes and closes the file. Throws std::runtime_error if a write
+     * failed. The destructor closes the file silently if not closed.
+     */
+    void close();
+
+    /** False if a write failed.
+     */
+    bool good() const {return !failed;}
+
+private:
+    FILE* file;
+    bool owned;
+    bool failed = false;
+    std::string filename;
+};
+
+class PoseRecordReader {
+
+public:
+
+    /** Throws std::runtime_error if the file is not a pose record stream,
+     * or of an unknown version. If filename is "-", reads from the standard
+     * input.
+     */
+    explicit PoseRecordReader(const std::string& filename);
+    ~PoseRecordReader();
+
+    PoseRecordReader(const PoseRecordReader&) = delete;
+    PoseRecordReader& operator=(const PoseRecordReader&) = delete;
+
+    /** Reads the next record. Returns false at the end of the stream, and
+     * throws std::runtime_error if the stream is truncated.
+     */
+    bool next(pose_record& record);
+
+private:
+    FILE* file;
+    bool owned;
+    std::vector<char> buffer;
+};
+
+#endif // __POSE_RECORD
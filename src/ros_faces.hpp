@@ -0,0 +1,140 @@
+#ifndef __ROS_FACES
+#define __ROS_FACES
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <ros/ros.h>
+#include <std_msgs/Char.h>
+#include <std_msgs/Header.h>
+#include <tf/transform_broadcaster.h>
+#include <tf/transform_datatypes.h>
+
+#include <gazr/Faces.h>
+
+#include "head_pose_estimation.hpp"
+
+// cached frame names beyond that are forgotten (the face ids keep growing)
+static const size_t MAX_CACHED_FACE_FRAMES=64;
+
+/** Publishes the faces of each frame, in one shot: their number on
+ * gazr/detected_faces/count, their ids, poses and reprojection errors as a
+ * gazr/Faces message on gazr/detected_faces (only while it has subscribers),
+ * and their TF frames (<prefix>_<id>), all sent in a single broadcast.
+ *
+ * Faces with a reprojection error larger than maxReprojectionError (if > 0)
+ * are not published (but are counted).
+ */
+class FacesPublisher {
+
+public:
+
+    FacesPublisher(const std::string& prefix,
+                   double maxReprojectionError,
+                   bool publishTf) :
+        maxReprojectionError(maxReprojectionError),
+        publishTf(publishTf),
+        prefix(prefix) {}
+
+    /** Advertises the topics. connection_cb is called when a subscriber
+     * (dis)connects: to be called once the owner is fully constructed.
+     */
+    void advertise(ros::NodeHandle& node,
+                   const ros::SubscriberStatusCallback& connection_cb = ros::SubscriberStatusCallback())
+    {
+        count_pub = node.advertise<std_msgs::Char>("gazr/detected_faces/count", 1, connection_cb, connection_cb);
+        faces_pub = node.advertise<gazr::Faces>("gazr/detected_faces", 1, connection_cb, connection_cb);
+    }
+
+    /** True if someone listens to the number of faces or to the faces (TF
+     * listeners can not be counted).
+     */
+    bool hasSubscribers() const {
+        return count_pub.getNumSubscribers() > 0 || faces_pub.getNumSubscribers() > 0;
+    }
+
+    /** True if the head poses are needed (TF frames, or gazr/detected_faces
+     * subscribers), and not only the number of faces.
+     */
+    bool posesWanted() const {return publishTf || faces_pub.getNumSubscribers() > 0;}
+
+    /** 'header': stamp of the poses (the frame's, or later if extrapolated)
+     * and camera frame. poses, reprojection_errors and ids are per face (poses
+     * may be empty if !posesWanted()).
+     */
+    void publish(const std_msgs::Header& header,
+                 size_t nb_faces,
+                 const std::vector<head_pose>& poses,
+                 const std::vector<double>& reprojection_errors,
+                 const std::vector<unsigned long>& ids)
+    {
+        std_msgs::Char count;
+        count.data = nb_faces;
+        count_pub.publish(count);
+
+        bool faces_wanted = faces_pub.getNumSubscribers() > 0;
+        if (!publishTf && !faces_wanted) return;
+
+        gazr::FacesPtr faces_msg(new gazr::Faces);
+        faces_msg->header = header;
+
+        transforms.clear();
+
+        for (size_t i = 0; i < poses.size(); ++i) {
+
+            // bad fit: do not publish it
+            if (maxReprojectionError > 0 && reprojection_errors[i] > maxReprojectionError) continue;
+
+            const auto& trans = poses[i];
+
+            // the basis is set as is: no round-trip through a quaternion
+            tf::Transform face_pose(tf::Matrix3x3(trans(0,0), trans(0,1), trans(0,2),
+                                                  trans(1,0), trans(1,1), trans(1,2),
+                                                  trans(2,0), trans(2,1), trans(2,2)),
+                                    tf::Vector3(trans(0,3), trans(1,3), trans(2,3)));
+
+            const auto& frame = frameId(ids[i]);
+
+            if (publishTf) {
+                transforms.emplace_back(face_pose, header.stamp, header.frame_id, frame);
+            }
+
+            if (faces_wanted) {
+                gazr::Face face;
+                face.id = ids[i];
+                face.frame_id = frame;
+                tf::poseTFToMsg(face_pose, face.pose);
+                face.reprojection_error = reprojection_errors[i];
+                faces_msg->faces.push_back(std::move(face));
+            }
+        }
+
+        if (!transforms.empty()) br.sendTransform(transforms);
+        if (faces_wanted) faces_pub.publish(faces_msg);
+    }
+
+private:
+
+    double maxReprojectionError;
+    bool publishTf;
+
+    std::string prefix;
+
+    ros::Publisher count_pub;
+    ros::Publisher faces_pub;
+    tf::TransformBroadcaster br;
+
+    std::vector<tf::StampedTransform> transforms; // reused
+    std::map<unsigned long, std::string> frame_ids;
+
+    const std::string& frameId(unsigned long id) {
+        auto it = frame_ids.find(id);
+        if (it != frame_ids.end()) return it->second;
+
+        if (frame_ids.size() >= MAX_CACHED_FACE_FRAMES) frame_ids.clear();
+        return frame_ids.emplace(id, prefix + "_" + std::to_string(id)).first->second;
+    }
+};
+
+#endif // __ROS_FACES
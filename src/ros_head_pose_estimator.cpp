@@ -1,31 +1,102 @@
 #include "ros_head_pose_estimator.hpp"
-
-#include "tf/transform_listener.h"
+#include "ros_image.hpp"
 
 using namespace std;
 using namespace cv;
 
-// how many second in the *future* the face transformation should be published?
-// this allow to compensate for the 'slowness' of face detection, but introduce
-// some lag in TF.
-#define TRANSFORM_FUTURE_DATING 0
-
 HeadPoseEstimator::HeadPoseEstimator(ros::NodeHandle& rosNode,
                                      const string& prefix,
-                                     const string& modelFilename):
+                                     const string& modelFilename,
+                                     const EstimatorParameters& params):
             rosNode(rosNode),
             it(rosNode),
+            faces(prefix, params.maxReprojectionError, params.publishTf),
+            stats(rosNode, "gazr: " + prefix),
             facePrefix(prefix),
-            estimator(modelFilename)
+            estimator(modelFilename, 455., params.detectionInterval, params.nbThreads),
+            posePrediction(params.poseFiltering ? params.posePrediction : 0.),
+            budget(params),
+            lazy(params.lazy),
+            publishTf(params.publishTf),
+            pipelined(params.pipelined),
+            tracker(params.trackLifetime),
+            poseFiltering(params.poseFiltering),
+            filterMinCutoff(params.filterMinCutoff),
+            filterBeta(params.filterBeta)
 
 {
-    sub = it.subscribeCamera("rgb", 1, &HeadPoseEstimator::detectFaces, this);
+    params.apply(estimator);
 
-    nb_detected_faces_pub = rosNode.advertise<std_msgs::Char>("gazr/detected_faces/count", 1);
+    if (pipelined && budget.enabled()) {
+        ROS_WARN("The compute budget (max_fps, cpu_budget) is not supported in pipelined mode: ignored");
+        budget.maxFps = 0.;
+        budget.cpuBudget = 0.;
+    }
+
+    auto connection_cb = [this](const ros::SingleSubscriberPublisher&) { updateSubscription(); };
+    faces.advertise(rosNode, connection_cb);
 
 #ifdef HEAD_POSE_ESTIMATION_DEBUG
-    pub = it.advertise("gazr/detected_faces/image",1);
+    auto image_connection_cb = [this](const image_transport::SingleSubscriberPublisher&) { updateSubscription(); };
+    pub = it.advertise("gazr/detected_faces/image", 1, image_connection_cb, image_connection_cb);
 #endif
+
+    if (pipelined) {
+        detection_thread = std::thread(&HeadPoseEstimator::detectionStage, this);
+        fitting_thread = std::thread(&HeadPoseEstimator::fittingStage, this);
+        publishing_thread = std::thread(&HeadPoseEstimator::publishingStage, this);
+    }
+
+    updateSubscription();
+}
+
+HeadPoseEstimator::~HeadPoseEstimator()
+{
+    if (pipelined) {
+        {
+            std::lock_guard<std::mutex> lock(subscription_mutex);
+            sub.shutdown();
+            subscribed = false;
+        }
+
+        to_detect.close();
+        to_fit.close();
+        to_publish.close();
+
+        detection_thread.join();
+        fitting_thread.join();
+        publishing_thread.join();
+    }
+}
+
+void HeadPoseEstimator::updateSubscription()
+{
+    std::lock_guard<std::mutex> lock(subscription_mutex);
+
+    bool needed = !lazy || publishTf ||
+                  faces.hasSubscribers() ||
+                  pub.getNumSubscribers() > 0;
+
+    if (needed && !subscribed) {
+        if (pipelined) {
+            sub = it.subscribeCamera("rgb", 1, &HeadPoseEstimator::queueFrame, this);
+        }
+        else {
+            sub = it.subscribeCamera("rgb", 1, &HeadPoseEstimator::detectFaces, this);
+        }
+        subscribed = true;
+        if (lazy) ROS_INFO("New subscriber: subscribing to the camera");
+    }
+    else if (!needed && subscribed) {
+        sub.shutdown();
+        subscribed = false;
+        ROS_INFO("No more subscribers: unsubscribing from the camera");
+    }
+}
+
+bool HeadPoseEstimator::posesWanted() const
+{
+    return faces.posesWanted() || pub.getNumSubscribers() > 0;
 }
 
 void HeadPoseEstimator::detectFaces(const sensor_msgs::ImageConstPtr& rgb_msg, 
@@ -33,6 +104,12 @@ void HeadPoseEstimator::detectFaces(const sensor_msgs::ImageConstPtr& rgb_msg,
 {
     ROS_INFO_ONCE("First RGB image received");
 
+    // over the compute budget: the skipped frames are counted as dropped by
+    // the stats
+    if (!budget.admit()) return;
+    auto processing_start = std::chrono::steady_clock::now();
+    if (budget.enabled()) budget.apply(estimator);
+
     // updating the camera model is cheap if not modified
     cameramodel.fromCameraInfo(camerainfo);
 
@@ -42,8 +119,9 @@ void HeadPoseEstimator::detectFaces(const sensor_msgs::ImageConstPtr& rgb_msg,
 
     // hopefully no copy here:
     //  - assignement operator of cv::Mat does not copy the data
-    //  - toCvShare does no copy if the default (source) encoding is used.
-    auto rgb = cv_bridge::toCvShare(rgb_msg, "bgr8")->image; 
+    //  - toCvShare does no copy if the default (source) encoding is used
+    //    (bgr8 or mono8, see estimatorImage()).
+    auto rgb = estimatorImage(rgb_msg)->image;
 
     // got an empty image!
     if (rgb.size().area() == 0) return;
@@ -52,64 +130,173 @@ void HeadPoseEstimator::detectFaces(const sensor_msgs::ImageConstPtr& rgb_msg,
     *                      Faces detection                           *
     ********************************************************************/
 
-    auto all_features = estimator.update(rgb);
+    auto all_features = estimator.update(rgb, rgb_msg->header.stamp.toSec());
+
+    // if only the number of faces is wanted, the head poses are not computed
+    vector<head_pose> poses;
+    if (posesWanted()) poses = estimator.poses();
+
+    // latency compensation
+    if (posePrediction > 0) {
+        for (size_t i = 0; i < poses.size(); ++i) {
+            poses[i] = estimator.predictedPose(i, posePrediction);
+        }
+    }
+
+    vector<double> reprojection_errors;
+    for (size_t i = 0; i < poses.size(); ++i) {
+        reprojection_errors.push_back(estimator.reprojectionError(i));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    Mat debug_image;
+#ifdef HEAD_POSE_ESTIMATION_DEBUG
+    if (pub.getNumSubscribers() > 0) debug_image = estimator.drawDetections(rgb, all_features, poses);
+#endif
 
-    auto poses = estimator.poses();
+    publishFaces(rgb_msg->header, cameramodel.tfFrame(), debug_image, all_features, poses, reprojection_errors, estimator.faceIds());
+    auto publishing = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    budget.record(processing_start, stats);
+    stats.record(rgb_msg->header, estimator.timings(), publishing);
+}
+
+void HeadPoseEstimator::publishFaces(const std_msgs::Header& header,
+                                     const string& camera_frame,
+                                     const Mat& debug_image,
+                                     const vector<vector<Point>>& all_features,
+                                     const vector<head_pose>& poses,
+                                     const vector<double>& reprojection_errors,
+                                     const vector<unsigned long>& ids)
+{
 #ifdef HEAD_POSE_ESTIMATION_DEBUG
     ROS_INFO_STREAM(poses.size() << " faces detected.");
 #endif
 
-    std_msgs::Char nb_faces;
-    nb_faces.data = poses.size();
-
-    nb_detected_faces_pub.publish(nb_faces);
-
-    for(size_t face_idx = 0; face_idx < poses.size(); ++face_idx) {
-
-        auto trans = poses[face_idx];
-
-        tf::Transform face_pose;
-
-        face_pose.setOrigin( tf::Vector3( trans(0,3),
-                                          trans(1,3),
-                                          trans(2,3)) );
-
-        tf::Quaternion qrot;
-        tf::Matrix3x3 mrot(
-                trans(0,0), trans(0,1), trans(0,2),
-                trans(1,0), trans(1,1), trans(1,2),
-                trans(2,0), trans(2,1), trans(2,2));
-        mrot.getRotation(qrot);
-        face_pose.setRotation(qrot);
-
-        tf::StampedTransform transform(face_pose, 
-                rgb_msg->header.stamp,  // publish the transform with the same timestamp as the frame originally used
-                cameramodel.tfFrame(),
-                facePrefix + "_" + to_string(face_idx));
-        br.sendTransform(transform);
-
-//    tf::TransformListener tf;
-//    tf.waitForTransform("face_0", "head_tracking_camera", ros::Time(), ros::Duration(1.0));
-//    tf::StampedTransform echo_transform;
-//    tf.lookupTransform("face_0", "head_tracking_camera", ros::Time(), echo_transform);
-
-//        // Code to compute yaw-picth-roll
-//        double yaw, pitch, roll;
-//        transform.getBasis().getRPY(roll, pitch, yaw);
-//        minp = max(minp, abs(pitch));
-//        minr = max(minr, abs(roll));
-//        miny = max(miny, abs(yaw));
-//        ROS_DEBUG_STREAM("Rotation in RPY (degree) [" <<  roll*180.0/M_PI << ", " << pitch*180.0/M_PI << ", " << yaw*180.0/M_PI << "]" << std::endl);
-//        ROS_DEBUG_STREAM("Max Rotation in RPY (degree) [" <<  minr*180.0/M_PI << ", " << minp*180.0/M_PI << ", " << miny*180.0/M_PI << "]" << std::endl);
-//
-    }
+    // publish the poses with the same timestamp as the frame originally used
+    // (or in the future, if the poses are extrapolated)
+    std_msgs::Header faces_header;
+    faces_header.stamp = header.stamp + ros::Duration(posePrediction);
+    faces_header.frame_id = camera_frame;
+
+    faces.publish(faces_header, all_features.size(), poses, reprojection_errors, ids);
 
 #ifdef HEAD_POSE_ESTIMATION_DEBUG
-    if(pub.getNumSubscribers() > 0) {
+    if(!debug_image.empty()) {
         ROS_INFO_ONCE("Starting to publish face tracking output for debug");
-        auto debugmsg = cv_bridge::CvImage(rgb_msg->header, "bgr8", estimator.drawDetections(rgb, all_features, poses)).toImageMsg();
+        auto debugmsg = cv_bridge::CvImage(header, "bgr8", debug_image).toImageMsg();
         pub.publish(debugmsg);
     }
 #endif
 }
 
+/********************************************************************
+*                         Pipelined mode                            *
+********************************************************************/
+
+void HeadPoseEstimator::queueFrame(const sensor_msgs::ImageConstPtr& rgb_msg,
+                                   const sensor_msgs::CameraInfoConstPtr& camerainfo)
+{
+    ROS_INFO_ONCE("First RGB image received");
+
+    Frame frame;
+    frame.received = std::chrono::steady_clock::now();
+    frame.msg = rgb_msg;
+    frame.camerainfo = camerainfo;
+
+    // no copy if the source encoding is bgr8 or mono8: the frame keeps a
+    // reference to the original message
+    frame.rgb = estimatorImage(rgb_msg);
+
+    // got an empty image!
+    if (frame.rgb->image.size().area() == 0) return;
+
+    if (!to_detect.push(std::move(frame))) {
+        ROS_DEBUG("Face detection too slow: dropping a frame");
+    }
+}
+
+void HeadPoseEstimator::detectionStage()
+{
+    Frame frame;
+    while (to_detect.pop(frame)) {
+        auto start = std::chrono::steady_clock::now();
+        frame.faces = estimator.detect(frame.rgb->image);
+        frame.timings.detected = true;
+        frame.timings.detection = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        to_fit.push(std::move(frame));
+    }
+}
+
+void HeadPoseEstimator::fittingStage()
+{
+    Frame frame;
+    while (to_fit.pop(frame)) {
+
+        // updating the camera model is cheap if not modified. The camera
+        // model and the estimator's intrinsics are only used by this stage.
+        cameramodel.fromCameraInfo(frame.camerainfo);
+
+        estimator.focalLength = cameramodel.fx();
+        estimator.opticalCenterX = cameramodel.cx();
+        estimator.opticalCenterY = cameramodel.cy();
+
+        auto start = std::chrono::steady_clock::now();
+        frame.ids = tracker.update(frame.faces);
+        frame.shapes = estimator.fit(frame.rgb->image, frame.faces);
+        auto fitted = std::chrono::steady_clock::now();
+        if (posesWanted()) frame.poses = estimator.poses(frame.shapes, &frame.reprojection_errors);
+
+        if (poseFiltering) {
+            for (size_t i = 0; i < frame.poses.size(); ++i) {
+                auto& filter = filters.emplace(frame.ids[i], PoseFilter(filterMinCutoff, filterBeta)).first->second;
+                filter.filter(frame.poses[i], frame.msg->header.stamp.toSec());
+                frame.poses[i] = filter.predict(posePrediction);
+            }
+
+            // forget the faces lost for good
+            for (auto filter = filters.begin(); filter != filters.end();) {
+                if (tracker.isTracked(filter->first)) ++filter;
+                else filter = filters.erase(filter);
+            }
+        }
+
+        frame.timings.landmarking = std::chrono::duration<double, std::milli>(fitted - start).count();
+        frame.timings.pnp = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - fitted).count();
+
+#ifdef HEAD_POSE_ESTIMATION_DEBUG
+        // drawn here: the publishing stage must not touch the estimator
+        if (pub.getNumSubscribers() > 0) {
+            frame.debug_image = estimator.drawDetections(frame.rgb->image, HeadPoseEstimation::features(frame.shapes), frame.poses);
+        }
+#endif
+
+        to_publish.push(std::move(frame));
+    }
+}
+
+void HeadPoseEstimator::publishingStage()
+{
+    Frame frame;
+    while (to_publish.pop(frame)) {
+        auto start = std::chrono::steady_clock::now();
+        publishFaces(frame.msg->header,
+                     frame.camerainfo->header.frame_id,
+                     frame.debug_image,
+                     HeadPoseEstimation::features(frame.shapes),
+                     frame.poses,
+                     frame.reprojection_errors,
+                     frame.ids);
+
+        auto end = std::chrono::steady_clock::now();
+        auto publishing = std::chrono::duration<double, std::milli>(end - start).count();
+        auto latency = std::chrono::duration<double, std::milli>(end - frame.received).count();
+        stats.record(frame.msg->header, frame.timings, publishing, latency);
+
+        ROS_DEBUG_STREAM("Frame " << frame.msg->header.seq << " processed in " << latency << "ms (end-to-end latency)");
+        ROS_INFO_STREAM_THROTTLE(10, "End-to-end latency: " << latency << "ms; "
+                                      << to_detect.dropped() << " frames dropped so far");
+    }
+}
@@ -1,15 +1,22 @@
 #include <string>
+#include <map>
+#include <mutex>
 #include <set>
+#include <thread>
+#include <chrono>
 
+#include "compute_budget.hpp"
 #include "head_pose_estimation.hpp"
+#include "latest_wins_queue.hpp"
+#include "ros_faces.hpp"
+#include "ros_parameters.hpp"
+#include "ros_stats.hpp"
 
 // opencv2
 #include <opencv2/core/core.hpp>
 
 // ROS
 #include <ros/ros.h>
-#include <std_msgs/Char.h>
-#include <tf/transform_broadcaster.h>
 #include <image_transport/image_transport.h>
 
 #include <image_geometry/pinhole_camera_model.h>
@@ -23,7 +30,10 @@ public:
 
     HeadPoseEstimator(ros::NodeHandle& rosNode,
                       const std::string& prefix,
-                      const std::string& modelFilename = "");
+                      const std::string& modelFilename = "",
+                      const EstimatorParameters& params = EstimatorParameters());
+
+    ~HeadPoseEstimator();
 
 private:
 
@@ -32,10 +42,11 @@ private:
     image_transport::CameraSubscriber sub;
     image_transport::Publisher pub;
 
-    ros::Publisher nb_detected_faces_pub;
+    // face count, faces and TF frames
+    FacesPublisher faces;
 
-    tf::TransformBroadcaster br;
-    tf::Transform transform;
+    // processing statistics, on gazr/stats
+    StatsPublisher stats;
 
     image_geometry::PinholeCameraModel cameramodel;
     cv::Mat cameraMatrix, distCoeffs;
@@ -48,5 +59,91 @@ private:
 
     void detectFaces(const sensor_msgs::ImageConstPtr& msg,
                      const sensor_msgs::CameraInfoConstPtr& camerainfo);
+
+    /** debug_image: the detections drawn on the frame, published on
+     * gazr/detected_faces/image if not empty.
+     */
+    void publishFaces(const std_msgs::Header& header,
+                      const std::string& camera_frame,
+                      const cv::Mat& debug_image,
+                      const std::vector<std::vector<cv::Point>>& all_features,
+                      const std::vector<head_pose>& poses,
+                      const std::vector<double>& reprojection_errors,
+                      const std::vector<unsigned long>& ids);
+
+    // the poses are published that many seconds in the future (extrapolated)
+    double posePrediction;
+
+    // adapts the processing to the compute budget (non-pipelined mode only)
+    ComputeBudget budget;
+
+    // Demand-driven mode
+    /////////////////////////////////////////////////////////
+    // if lazy, the camera is only subscribed while someone listens to our
+    // outputs (or if TF frames are published)
+    bool lazy;
+    bool publishTf;
+
+    std::mutex subscription_mutex;
+    bool subscribed = false;
+
+    /** (Un)subscribes to the camera, depending on the subscribers of our
+     * outputs. Called by the publishers' (dis)connection callbacks.
+     */
+    void updateSubscription();
+
+    /** True if the head poses are needed (TF, debug image), and not only the
+     * number of faces.
+     */
+    bool posesWanted() const;
+
+    // Pipelined mode
+    /////////////////////////////////////////////////////////
+    // The image callback only queues the latest frame. Face detection,
+    // facial features fitting + head pose estimation, and publishing of the
+    // results run each in their own thread, connected by latest-wins queues.
+
+    struct Frame {
+        sensor_msgs::ImageConstPtr msg;
+        sensor_msgs::CameraInfoConstPtr camerainfo;
+        cv_bridge::CvImageConstPtr rgb;
+        std::chrono::steady_clock::time_point received;
+        stage_timings timings;
+
+        std::vector<dlib::rectangle> faces;
+        std::vector<dlib::full_object_detection> shapes;
+        std::vector<head_pose> poses;
+        std::vector<double> reprojection_errors;
+        std::vector<unsigned long> ids;
+
+        // drawn by the fitting stage (that owns the estimator's intrinsics)
+        cv::Mat debug_image;
+    };
+
+    bool pipelined;
+
+    LatestWinsQueue<Frame> to_detect;
+    LatestWinsQueue<Frame> to_fit;
+    LatestWinsQueue<Frame> to_publish;
+
+    // identities of the faces (only used by the fitting stage: in
+    // non-pipelined mode, the estimator tracks the faces itself)
+    FaceTracker tracker;
+
+    // pose filter of each face (pipelined mode only, by face identifier)
+    bool poseFiltering;
+    double filterMinCutoff, filterBeta;
+    std::map<unsigned long, PoseFilter> filters;
+
+    std::thread detection_thread;
+    std::thread fitting_thread;
+    std::thread publishing_thread;
+
+    void queueFrame(const sensor_msgs::ImageConstPtr& msg,
+                    const sensor_msgs::CameraInfoConstPtr& camerainfo);
+
+    void detectionStage();
+    void fittingStage();
+    void publishingStage();
 };
 
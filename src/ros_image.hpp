@@ -0,0 +1,27 @@
+#ifndef __ROS_IMAGE
+#define __ROS_IMAGE
+
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/image_encodings.h>
+#include <cv_bridge/cv_bridge.h>
+
+/** Returns the image of the message in a format accepted by
+ * HeadPoseEstimation::update(), with as few conversions as possible:
+ *  - mono8 images are used as is, without any copy;
+ *  - for yuv422 images, only the luma is extracted;
+ *  - other encodings are converted to bgr8 (no copy if already bgr8).
+ *
+ * Non-BGR images are converted to BGR anyway if they are needed by the
+ * face detector (CNN, OpenCV DNN detectors), but only after downscaling.
+ */
+inline cv_bridge::CvImageConstPtr estimatorImage(const sensor_msgs::ImageConstPtr& msg)
+{
+    namespace enc = sensor_msgs::image_encodings;
+
+    if (msg->encoding == enc::MONO8 || msg->encoding == enc::YUV422) {
+        return cv_bridge::toCvShare(msg, enc::MONO8);
+    }
+    return cv_bridge::toCvShare(msg, enc::BGR8);
+}
+
+#endif // __ROS_IMAGE
@@ -0,0 +1,201 @@
+#ifndef __ROS_PARAMETERS
+#define __ROS_PARAMETERS
+
+#include <algorithm>
+#include <memory>
+#include <string>
+
+#include <ros/ros.h>
+
+#include "head_pose_estimation.hpp"
+
+/** Tuning parameters of the gazr ROS nodes, shared by the stand-alone
+ * 'estimate' node and the nodelets.
+ */
+struct EstimatorParameters {
+
+    // run the full face detector every detectionInterval frames only, and
+    // track the faces in between
+    unsigned int detectionInterval = 1;
+
+    // faces are detected on a downscaled image, either by detectionScale, or
+    // so that faces of minFaceSize pixels can still be detected
+    float detectionScale = 1.;
+    unsigned int minFaceSize = 0;
+
+    // number of threads used to process the detected faces in parallel
+    unsigned int nbThreads = 1;
+
+    // if true, face detection, head pose estimation and publishing run in
+    // separate threads, decoupled from the image callback (RGB-only)
+    bool pipelined = false;
+
+    // PnP algorithm, and number of facial features used to solve the pose
+    PNP_SOLVER pnpSolver = PNP_ITERATIVE;
+    bool extendedHeadModel = false;
+
+    // if > 0, faces whose head pose reprojection error (in pixels) is above
+    // this threshold are not published
+    double maxReprojectionError = 0.;
+
+    // number of frames a face that is not detected anymore keeps its
+    // identifier (and hence its TF frame name)
+    unsigned int trackLifetime = 10;
+
+    // temporal filtering of the head poses (see PoseFilter)
+    bool poseFiltering = false;
+    double filterMinCutoff = 1.;
+    double filterBeta = 0.5;
+
+    // if > 0, the head poses are extrapolated (from the head velocities
+    // estimated by the pose filter) and published posePrediction seconds in
+    // the future, to compensate for the processing latency
+    double posePrediction = 0.;
+
+    // Demand-driven processing: if lazy, the camera is only subscribed while
+    // the outputs of gazr have subscribers. TF listeners can not be counted:
+    // if publishTf, TF frames are published, and the camera is always
+    // subscribed
+    bool lazy = false;
+    bool publishTf = true;
+
+    // Compute budget (see ComputeBudget): maximum frame rate, and maximum
+    // processing time (ms) per second. 0: no limit. Above the budget, the
+    // faces are tracked instead of detected, then detected at a lower
+    // resolution, then frames are skipped
+    double maxFps = 0.;
+    double cpuBudget = 0.;
+
+    // RGB-D only: the depth of each facial feature is the median of the
+    // valid depths in a depthWindow x depthWindow window (odd, <= 9; 1: the
+    // depth of the feature's pixel only)
+    int depthWindow = 1;
+
+    // RGB-D only: if true, the head pose is computed by rigid alignment of
+    // the head model to the 3D facial features (falling back to PnP if the
+    // depth is missing), optionally refined by PnP
+    bool depthPose = false;
+    bool depthPoseRefine = false;
+
+    // RGB-D only: synchronization of the RGB and depth streams:
+    //  - "exact": RGB and depth frames with the same timestamp only
+    //  - "approximate": message_filters' approximate time policy
+    //  - "nearest": every RGB frame is processed (at the camera frame rate),
+    //    with the closest depth frame, if less than maxDepthDelay seconds away
+    std::string depthSync = "exact";
+    double maxDepthDelay = 0.05;
+
+    // face detector: "hog" (dlib's default), "cnn" (dlib's MMOD, with
+    // faceDetectorModel mmod_human_face_detector.dat), or "opencv_dnn" (SSD,
+    // with faceDetectorConfig the .prototxt and faceDetectorModel the
+    // .caffemodel)
+    std::string faceDetector = "hog";
+    std::string faceDetectorModel;
+    std::string faceDetectorConfig;
+
+    /** Reads the parameters from the (private) node handle, using the
+     * current values as defaults.
+     */
+    void load(const ros::NodeHandle& private_node) {
+
+        int interval = detectionInterval;
+        private_node.param<int>("detection_interval", interval, interval);
+        detectionInterval = std::max(interval, 1);
+
+        double scale = detectionScale;
+        private_node.param<double>("detection_scale", scale, scale);
+        detectionScale = scale;
+
+        int face_size = minFaceSize;
+        private_node.param<int>("min_face_size", face_size, face_size);
+        minFaceSize = std::max(face_size, 0);
+
+        int threads = nbThreads;
+        private_node.param<int>("threads", threads, threads);
+        nbThreads = std::max(threads, 1);
+
+        private_node.param<bool>("pipelined", pipelined, pipelined);
+
+        std::string solver;
+        private_node.param<std::string>("pnp_solver", solver, "");
+        if (solver == "iterative") pnpSolver = PNP_ITERATIVE;
+        else if (solver == "epnp_refine") pnpSolver = PNP_EPNP_REFINE;
+        else if (solver == "sqpnp") pnpSolver = PNP_SQPNP;
+        else if (solver == "epnp") pnpSolver = PNP_EPNP;
+        else if (!solver.empty()) {
+            ROS_WARN_STREAM("Unknown PnP solver " << solver << ". Valid values are: iterative, epnp_refine, sqpnp, epnp");
+        }
+
+        private_node.param<bool>("extended_head_model", extendedHeadModel, extendedHeadModel);
+        private_node.param<double>("max_reprojection_error", maxReprojectionError, maxReprojectionError);
+
+        int lifetime = trackLifetime;
+        private_node.param<int>("face_track_lifetime", lifetime, lifetime);
+        trackLifetime = std::max(lifetime, 0);
+
+        private_node.param<bool>("pose_filtering", poseFiltering, poseFiltering);
+        private_node.param<double>("pose_filter_min_cutoff", filterMinCutoff, filterMinCutoff);
+        private_node.param<double>("pose_filter_beta", filterBeta, filterBeta);
+        private_node.param<double>("pose_prediction", posePrediction, posePrediction);
+        if (posePrediction > 0 && !poseFiltering) {
+            ROS_WARN("pose_prediction requires pose_filtering: the head poses will not be extrapolated");
+        }
+
+        private_node.param<int>("depth_window", depthWindow, depthWindow);
+        depthWindow = std::min(std::max(depthWindow, 1), 9) | 1;
+        private_node.param<bool>("depth_pose", depthPose, depthPose);
+        private_node.param<bool>("depth_pose_refine", depthPoseRefine, depthPoseRefine);
+        private_node.param<std::string>("depth_sync", depthSync, depthSync);
+        if (depthSync != "exact" && depthSync != "approximate" && depthSync != "nearest") {
+            ROS_WARN_STREAM("Unknown depth synchronization " << depthSync << ". Valid values are: exact, approximate, nearest");
+            depthSync = "exact";
+        }
+        private_node.param<double>("max_depth_delay", maxDepthDelay, maxDepthDelay);
+
+        private_node.param<double>("max_fps", maxFps, maxFps);
+        private_node.param<double>("cpu_budget", cpuBudget, cpuBudget);
+
+        private_node.param<bool>("lazy", lazy, lazy);
+        private_node.param<bool>("publish_tf", publishTf, publishTf);
+        if (lazy && publishTf) {
+            ROS_INFO("lazy is set, but TF frames are published (publish_tf): the camera stays subscribed");
+        }
+
+        private_node.param<std::string>("face_detector", faceDetector, faceDetector);
+        private_node.param<std::string>("face_detector_model", faceDetectorModel, faceDetectorModel);
+        private_node.param<std::string>("face_detector_config", faceDetectorConfig, faceDetectorConfig);
+    }
+
+    /** Configures the estimator with these parameters (except the ones
+     * passed to its constructor).
+     */
+    void apply(HeadPoseEstimation& estimator) const {
+
+        estimator.detectionScale = detectionScale;
+        estimator.minFaceSize = minFaceSize;
+        estimator.pnpSolver = pnpSolver;
+        estimator.extendedHeadModel = extendedHeadModel;
+        estimator.trackLifetime = trackLifetime;
+        estimator.poseFiltering = poseFiltering;
+        estimator.filterMinCutoff = filterMinCutoff;
+        estimator.filterBeta = filterBeta;
+
+        if (faceDetector == "cnn") {
+            ROS_INFO_STREAM("Using dlib's CNN face detector " << faceDetectorModel);
+            estimator.setFaceDetector(std::unique_ptr<FaceDetector>(new CnnFaceDetector(faceDetectorModel)));
+        }
+        else if (faceDetector == "opencv_dnn") {
+#ifdef OPENCV_DNN
+            ROS_INFO_STREAM("Using OpenCV DNN face detector " << faceDetectorModel);
+            estimator.setFaceDetector(std::unique_ptr<FaceDetector>(new OpenCvDnnFaceDetector(faceDetectorConfig, faceDetectorModel)));
+#else
+            ROS_WARN("gazr has been compiled without OpenCV DNN support. Using the default face detector.");
+#endif
+        }
+        else if (faceDetector != "hog") {
+            ROS_WARN_STREAM("Unknown face detector " << faceDetector << ". Valid values are: hog, cnn, opencv_dnn");
+        }
+    }
+};
+
+#endif // __ROS_PARAMETERS
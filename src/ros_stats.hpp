@@ -0,0 +1,175 @@
+#ifndef __ROS_STATS
+#define __ROS_STATS
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+
+#include <ros/ros.h>
+#include <std_msgs/Header.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
+
+#include "head_pose_estimation.hpp"
+
+/** Accumulates the per-frame processing statistics (stage timings, dropped
+ * frames, achieved frame rate) and periodically publishes them as a
+ * diagnostic_msgs/DiagnosticArray, along with status values set by the node
+ * (eg the compute budget policy).
+ *
+ * Nothing is accumulated (nor published) while nobody is subscribed.
+ * record() must always be called from the same thread.
+ */
+class StatsPublisher {
+
+public:
+
+    StatsPublisher(ros::NodeHandle& node,
+                   const std::string& name,
+                   double period = 1.) :
+        name(name),
+        period(period),
+        last_seq(0),
+        has_last_seq(false)
+    {
+        pub = node.advertise<diagnostic_msgs::DiagnosticArray>("gazr/stats", 1);
+        reset();
+    }
+
+    /** To be called once per processed frame. 'header' is the header of the
+     * input image: gaps in the sequence numbers are counted as dropped
+     * frames (reported as unavailable if the sequence numbers never
+     * increase: not all drivers fill them, nor intra-process publishers).
+     * latency is the end-to-end processing time of the frame, if
+     * known (< 0 otherwise).
+     */
+    void record(const std_msgs::Header& header,
+                const stage_timings& timings,
+                double publishing,
+                double latency = -1.)
+    {
+        auto seq = header.seq;
+        if (has_last_seq && seq > last_seq) seq_available = true;
+        bool gap = has_last_seq && seq > last_seq + 1;
+        auto nb_dropped = gap ? seq - last_seq - 1 : 0;
+        last_seq = seq;
+        has_last_seq = true;
+
+        if (pub.getNumSubscribers() == 0) {
+            reset();
+            return;
+        }
+
+        nb_frames++;
+        dropped_frames += nb_dropped;
+        if (timings.detected) nb_detections++;
+
+        add("detection", timings.detection);
+        add("landmarking", timings.landmarking);
+        add("pnp", timings.pnp);
+        add("publishing", publishing);
+        if (latency >= 0.) add("latency", latency);
+
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - period_start).count();
+        if (elapsed >= period) {
+            publish(elapsed);
+            reset();
+        }
+    }
+
+    /** Sets a status value, published with the next statistics (until
+     * changed).
+     */
+    void setStatus(const std::string& key, const std::string& value) {
+        status_values[key] = value;
+    }
+
+private:
+
+    struct Accumulator {
+        double total = 0.;
+        double max = 0.;
+        size_t count = 0;
+    };
+
+    ros::Publisher pub;
+    std::string name;
+    double period;
+
+    uint32_t last_seq;
+    bool has_last_seq;
+    bool seq_available = false; // false until header.seq increases
+
+    std::chrono::steady_clock::time_point period_start;
+    size_t nb_frames;
+    size_t nb_detections;
+    size_t dropped_frames;
+    std::map<std::string, Accumulator> durations;
+    std::map<std::string, std::string> status_values;
+
+    void reset() {
+        period_start = std::chrono::steady_clock::now();
+        nb_frames = 0;
+        nb_detections = 0;
+        dropped_frames = 0;
+        durations.clear();
+    }
+
+    void add(const std::string& stage, double duration) {
+        auto& acc = durations[stage];
+        acc.total += duration;
+        acc.max = std::max(acc.max, duration);
+        acc.count++;
+    }
+
+    void addValue(diagnostic_msgs::DiagnosticStatus& status,
+                  const std::string& key, double value) {
+        diagnostic_msgs::KeyValue kv;
+        kv.key = key;
+        kv.value = std::to_string(value);
+        status.values.push_back(kv);
+    }
+
+    void publish(double elapsed) {
+        diagnostic_msgs::DiagnosticStatus status;
+        status.name = name;
+        status.level = diagnostic_msgs::DiagnosticStatus::OK;
+
+        double fps = nb_frames / elapsed;
+        status.message = std::to_string(fps) + " fps";
+
+        addValue(status, "fps", fps);
+        addValue(status, "frames", nb_frames);
+        if (seq_available) {
+            addValue(status, "dropped frames", dropped_frames);
+        }
+        else {
+            ROS_WARN_ONCE("The input images have no sequence numbers: the dropped frames can not be counted");
+            diagnostic_msgs::KeyValue kv;
+            kv.key = "dropped frames";
+            kv.value = "unavailable";
+            status.values.push_back(kv);
+        }
+        addValue(status, "detections", nb_detections);
+
+        // mean and max durations, in ms
+        for (const auto& d : durations) {
+            addValue(status, d.first + " (ms)", d.second.total / d.second.count);
+            addValue(status, d.first + " max (ms)", d.second.max);
+        }
+
+        for (const auto& v : status_values) {
+            diagnostic_msgs::KeyValue kv;
+            kv.key = v.first;
+            kv.value = v.second;
+            status.values.push_back(kv);
+        }
+
+        diagnostic_msgs::DiagnosticArray msg;
+        msg.header.stamp = ros::Time::now();
+        msg.status.push_back(status);
+        pub.publish(msg);
+    }
+};
+
+#endif // __ROS_STATS
@@ -0,0 +1,218 @@
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <opencv2/opencv.hpp>
+
+#include "../src/head_pose_estimation.hpp"
+
+#define STR_EXPAND(tok) #tok
+#define STR(tok) STR_EXPAND(tok)
+
+using namespace std;
+using namespace cv;
+namespace po = boost::program_options;
+
+typedef std::chrono::steady_clock benchmark_clock;
+
+const static vector<string> STAGES = {"detection", "landmarking", "pnp", "drawing"};
+
+// durations (in ms) of each stage, for one (resolution, nb of faces) configuration
+struct Samples {
+    map<string, vector<double>> durations;
+};
+
+inline double elapsed_ms(benchmark_clock::time_point start) {
+    return chrono::duration<double, milli>(benchmark_clock::now() - start).count();
+}
+
+// nearest-rank percentile. 'values' must be sorted.
+double percentile(const vector<double>& values, double p) {
+    if (values.empty()) return 0.;
+    size_t rank = static_cast<size_t>(ceil(p / 100. * values.size()));
+    return values[std::min(std::max(rank, size_t(1)), values.size()) - 1];
+}
+
+string stats(vector<double> values) {
+    sort(values.begin(), values.end());
+    double mean = 0.;
+    for (auto v : values) mean += v;
+    if (!values.empty()) mean /= values.size();
+
+    stringstream json;
+    json << "{\"mean\": " << mean
+         << ", \"p50\": " << percentile(values, 50)
+         << ", \"p95\": " << percentile(values, 95)
+         << ", \"p99\": " << percentile(values, 99)
+         << ", \"max\": " << (values.empty() ? 0. : values.back()) << "}";
+    return json.str();
+}
+
+vector<string> readCorpus(const string& filename) {
+    vector<string> images;
+    ifstream source(filename);
+    string line;
+    while (getline(source, line)) {
+        if (!line.empty() && line[0] != '#') images.push_back(line);
+    }
+    return images;
+}
+
+vector<int> parseWidths(const string& widths) {
+    vector<int> res;
+    stringstream ss(widths);
+    string width;
+    while (getline(ss, width, ',')) {
+        if (!width.empty()) res.push_back(stoi(width));
+    }
+    return res;
+}
+
+int main(int argc, char **argv) {
+
+    po::positional_options_description p;
+    p.add("corpus", 1);
+
+    po::options_description desc("Allowed options");
+    desc.add_options()("help,h", "produce help message")(
+        "version,v", "shows version and exits")(
+        "model", po::value<string>(), "dlib's trained face model")(
+        "corpus", po::value<string>(), "text file listing the benchmark images, one per line")(
+        "widths", po::value<string>()->default_value("320,640,1280"),
+         "comma-separated list of image widths to benchmark (0: original resolution)")(
+        "runs", po::value<int>()->default_value(20), "number of runs per image and resolution")(
+        "warmup", po::value<int>()->default_value(2), "number of untimed runs before each measure")(
+        "output,o", po::value<string>(), "JSON output file (default: stdout)");
+
+    po::variables_map vm;
+    po::store(
+        po::command_line_parser(argc, argv).options(desc).positional(p).run(),
+        vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+        cout << argv[0] << " " << STR(GAZR_VERSION) << "\n\n" << desc << "\n";
+        return 1;
+    }
+
+    if (vm.count("version")) {
+        cout << argv[0] << " " << STR(GAZR_VERSION) << "\n";
+        return 0;
+    }
+
+    if (vm.count("model") == 0 || vm.count("corpus") == 0) {
+        cerr << "You must specify the path to a trained dlib's face model\n"
+             << "with the option --model, and the list of benchmark images." << endl;
+        return 1;
+    }
+
+#ifdef HEAD_POSE_ESTIMATION_DEBUG
+    cerr <<  "ATTENTION! The benchmark is compiled in DEBUG mode: the performance is no going to be good!!" << endl;
+#endif
+
+    auto corpus = readCorpus(vm["corpus"].as<string>());
+    if (corpus.empty()) {
+        cerr << vm["corpus"].as<string>() << " does not exist, or has no image names" << endl;
+        return 1;
+    }
+
+    vector<Mat> images;
+    for (const auto& filename : corpus) {
+#ifdef OPENCV3
+        auto img = imread(filename, IMREAD_COLOR);
+#else
+        auto img = imread(filename, CV_LOAD_IMAGE_COLOR);
+#endif
+        if (img.empty()) {
+            cerr << "Could not read " << filename << endl;
+            return 1;
+        }
+        images.push_back(img);
+    }
+
+    auto widths = parseWidths(vm["widths"].as<string>());
+    int runs = std::max(vm["runs"].as<int>(), 1);
+    int warmup = std::max(vm["warmup"].as<int>(), 0);
+
+    HeadPoseEstimation estimator(vm["model"].as<string>());
+
+    // (width, nb of faces) -> durations
+    map<pair<int, size_t>, Samples> results;
+
+    for (auto width : widths) {
+        cerr << "Benchmarking " << (width > 0 ? to_string(width) + "px wide" : "original") << " images..." << endl;
+
+        for (const auto& original : images) {
+            Mat img = original;
+            if (width > 0 && width != original.cols) {
+                double scale = static_cast<double>(width) / original.cols;
+                resize(original, img, Size(), scale, scale, INTER_AREA);
+            }
+
+            // the optical center depends on the resolution
+            estimator.opticalCenterX = img.cols / 2;
+            estimator.opticalCenterY = img.rows / 2;
+
+            for (int run = -warmup; run < runs; run++) {
+
+                auto t = benchmark_clock::now();
+                auto faces = estimator.detect(img);
+                auto t_detection = elapsed_ms(t);
+
+                t = benchmark_clock::now();
+                auto shapes = estimator.fit(img, faces);
+                auto t_landmarking = elapsed_ms(t);
+
+                t = benchmark_clock::now();
+                auto poses = estimator.poses(shapes);
+                auto t_pnp = elapsed_ms(t);
+
+                t = benchmark_clock::now();
+                auto drawing = estimator.drawDetections(img, HeadPoseEstimation::features(shapes), poses);
+                auto t_drawing = elapsed_ms(t);
+
+                if (run < 0) continue;
+
+                auto& samples = results[make_pair(width > 0 ? width : img.cols, faces.size())];
+                samples.durations["detection"].push_back(t_detection);
+                samples.durations["landmarking"].push_back(t_landmarking);
+                samples.durations["pnp"].push_back(t_pnp);
+                samples.durations["drawing"].push_back(t_drawing);
+            }
+        }
+    }
+
+    stringstream json;
+    json << "{\n";
+    json << "  \"version\": \"" << STR(GAZR_VERSION) << "\",\n";
+    json << "  \"images\": " << images.size() << ",\n";
+    json << "  \"runs\": " << runs << ",\n";
+    json << "  \"results\": [";
+    bool first = true;
+    for (const auto& result : results) {
+        json << (first ? "\n" : ",\n");
+        first = false;
+        json << "    {\"width\": " << result.first.first
+             << ", \"faces\": " << result.first.second
+             << ", \"samples\": " << result.second.durations.at("detection").size();
+        for (const auto& stage : STAGES) {
+            json << ",\n     \"" << stage << "\": " << stats(result.second.durations.at(stage));
+        }
+        json << "}";
+    }
+    json << "\n  ]\n}\n";
+
+    if (vm.count("output")) {
+        ofstream out(vm["output"].as<string>());
+        out << json.str();
+    }
+    else {
+        cout << json.str();
+    }
+
+    return 0;
+}
@@ -0,0 +1,87 @@
+#define STR_EXPAND(tok) #tok
+#define STR(tok) STR_EXPAND(tok)
+
+#ifdef OPENCV3
+#include <opencv2/imgcodecs.hpp>
+#else
+#include <opencv2/highgui/highgui.hpp>
+#endif
+#include <opencv2/core/types_c.h>  // cvIplImage
+
+#include <cstdlib>
+#include <iostream>
+
+#include <dlib/opencv.h>
+#include <dlib/image_processing/frontal_face_detector.h>
+
+#include "../src/flat_shape_predictor.hpp"
+
+using namespace std;
+using namespace cv;
+
+// Checks that both models find the same facial features on the image
+bool check(const string& dlib_model, const string& flat_model, const string& image_filename)
+{
+#ifdef OPENCV3
+    Mat img = imread(image_filename, IMREAD_COLOR);
+#else
+    Mat img = imread(image_filename, CV_LOAD_IMAGE_COLOR);
+#endif
+    if (img.empty()) {
+        cerr << "Could not read " << image_filename << endl;
+        return false;
+    }
+
+    dlib::shape_predictor reference;
+    dlib::deserialize(dlib_model) >> reference;
+    FlatShapePredictor converted(flat_model);
+
+    auto ipl_img = cvIplImage(img);
+    auto dlib_image = dlib::cv_image<dlib::bgr_pixel>(&ipl_img);
+
+    auto detector = dlib::get_frontal_face_detector();
+    auto faces = detector(dlib_image);
+    cout << faces.size() << " face(s) found in " << image_filename << endl;
+
+    size_t nb_differences = 0;
+    for (const auto& face : faces) {
+        auto expected = reference(dlib_image, face);
+        auto actual = converted(dlib_image, face);
+        for (size_t i = 0; i < expected.num_parts(); ++i) {
+            if (expected.part(i) != actual.part(i)) nb_differences++;
+        }
+    }
+
+    if (nb_differences > 0) {
+        cerr << "ERROR: " << nb_differences << " facial features differ between the two models!" << endl;
+        return false;
+    }
+    cout << "The facial features found with both models are identical." << endl;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc < 3) {
+        cerr << argv[0] << " " << STR(GAZR_VERSION) << "\n\nUsage: "
+             << endl << argv[0] << " model.dat model.gazr [test_image.{jpg|png}]\n\n"
+             << "Converts a dlib shape predictor model to gazr's memory-mapped format.\n"
+             << "If an image is provided, checks that both models find the same facial features." << endl;
+        return 1;
+    }
+
+    try {
+        convertShapePredictor(argv[1], argv[2]);
+
+        FlatShapePredictor converted(argv[2]);
+        cout << argv[2] << " written (" << converted.num_parts() << " facial features)." << endl;
+    }
+    catch (const dlib::serialization_error& e) {
+        cerr << "Conversion failed: " << e.what() << endl;
+        return 1;
+    }
+
+    if (argc > 3 && !check(argv[1], argv[2], argv[3])) return 1;
+
+    return 0;
+}
@@ -1,9 +1,13 @@
 #include <boost/program_options.hpp>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <opencv2/opencv.hpp>
 
 #include "../src/head_pose_estimation.hpp"
+#include "../src/pose_record.hpp"
+#include "video_pipeline.hpp"
 #include "LinearMath/Matrix3x3.h"
 
 #define STR_EXPAND(tok) #tok
@@ -15,8 +19,59 @@ namespace po = boost::program_options;
 
 inline double todeg(double rad) { return rad * 180 / M_PI; }
 
+// Writes the poses of one frame as a JSON object, one line per frame
+void writeJson(ostream& out, const video_frame& frame) {
+
+    out << "{";
+
+    for (size_t i = 0; i < frame.poses.size(); ++i) {
+        auto pose = frame.poses[i].inv();
+
+        double raw_yaw, raw_pitch, raw_roll;
+        tf::Matrix3x3 mrot(pose(0, 0), pose(0, 1), pose(0, 2), pose(1, 0),
+                           pose(1, 1), pose(1, 2), pose(2, 0), pose(2, 1),
+                           pose(2, 2));
+        mrot.getRPY(raw_roll, raw_pitch, raw_yaw);
+
+        raw_roll = raw_roll - M_PI / 2;
+        raw_yaw = raw_yaw + M_PI / 2;
+
+        double yaw, pitch, roll;
+
+        roll = raw_pitch;
+        yaw = raw_yaw;
+        pitch = -raw_roll;
+
+        if (i > 0) out << ", ";
+        out << "\"face_" << frame.ids[i] << "\":";
+        out << setprecision(1) << fixed << "{\"yaw\":" << todeg(yaw)
+            << ", \"pitch\":" << todeg(pitch)
+            << ", \"roll\":" << todeg(roll) << ", ";
+        out << setprecision(4) << fixed << "\"x\":" << pose(0, 3)
+            << ", \"y\":" << pose(1, 3) << ", \"z\":" << pose(2, 3)
+            << "}";
+    }
+    out << "}\n";
+}
+
+void writeRecords(PoseRecordWriter& records, const video_frame& frame) {
+
+    pose_record record;
+    record.timestamp = frame.timestamp;
+
+    for (size_t i = 0; i < frame.poses.size(); ++i) {
+        record.face_id = frame.ids[i];
+        record.reprojection_error = frame.reprojection_errors[i];
+        for (size_t j = 0; j < NB_FEATURES; ++j) {
+            record.landmarks[j] = frame.features[i][j];
+        }
+        record.pose = frame.poses[i];
+        records.write(record);
+    }
+}
+
 int main(int argc, char **argv) {
-    Mat frame;
+    Mat frame_image;
     bool show_frame = false;
     bool use_camera = false;
 
@@ -28,7 +83,13 @@ int main(int argc, char **argv) {
         "version,v", "shows version and exits")(
         "show,s", "display the image with gaze estimation")(
         "model", po::value<string>(), "dlib's trained face model")(
-        "image", po::value<string>(), "image to process (png, jpg)");
+        "image", po::value<string>(), "image to process (png, jpg)")(
+        "video", po::value<string>(), "video file to process (instead of the camera)")(
+        "format", po::value<string>()->default_value("json"), "output format: json (one object per frame), or binary (see pose_record.hpp)")(
+        "output,o", po::value<string>()->default_value("-"), "output file ('-': standard output)")(
+        "threads", po::value<unsigned int>()->default_value(1), "number of estimation threads (decoding runs in its own thread)")(
+        "stride", po::value<unsigned int>()->default_value(1), "only process one frame out of <stride>")(
+        "hw-decode", "hardware-accelerated video decoding, if available");
 
     po::variables_map vm;
     po::store(
@@ -60,11 +121,36 @@ int main(int argc, char **argv) {
         use_camera = true;
     }
 
-    auto estimator = HeadPoseEstimation(vm["model"].as<string>());
+    const auto format = vm["format"].as<string>();
+    if (format != "json" && format != "binary") {
+        cerr << "Unknown output format " << format << " (json or binary expected)" << endl;
+        return 1;
+    }
+
+    const auto output = vm["output"].as<string>();
+    std::unique_ptr<PoseRecordWriter> records;
+    ofstream json_file;
+    if (format == "binary") {
+        records.reset(new PoseRecordWriter(output));
+    }
+    else if (output != "-") {
+        json_file.open(output);
+    }
+    ostream& json_out = output != "-" ? json_file : cout;
+
+    HeadPoseEstimation estimator(vm["model"].as<string>());
 
     VideoCapture video_in;
 
-    if (use_camera) {
+    if (vm.count("video")) {
+        openVideo(video_in, vm["video"].as<string>(), vm.count("hw-decode") > 0);
+
+        if (!video_in.isOpened()) {
+            cerr << "Couldn't open " << vm["video"].as<string>() << endl;
+            return 1;
+        }
+    }
+    else if (use_camera) {
         video_in = VideoCapture(0);
 
         // adjust for your webcam!
@@ -84,70 +170,102 @@ int main(int argc, char **argv) {
         auto image = vm["image"].as<string>();
 
 #ifdef OPENCV3
-        frame = imread(image, IMREAD_COLOR);
+        frame_image = imread(image, IMREAD_COLOR);
 #else
-        frame = imread(image, CV_LOAD_IMAGE_COLOR);
+        frame_image = imread(image, CV_LOAD_IMAGE_COLOR);
 #endif
 
-        resize(frame, frame, Size(0, 0), 0.2, 0.2);
+        resize(frame_image, frame_image, Size(0, 0), 0.2, 0.2);
 
-        estimator.focalLength = 85.0 / 22.3 * frame.size().width;
+        estimator.focalLength = 85.0 / 22.3 * frame_image.size().width;
     }
 
-    while (true) {
-        if (use_camera) {
-            auto ok = video_in.read(frame);
-            if (!ok) break;
-        }
-
-        auto all_features = estimator.update(frame);
-
-        auto poses = estimator.poses();
+    const bool is_video = vm.count("video") > 0;
 
-        int i = 0;
-        cout << "{";
+    auto output_frame = [&](const video_frame& frame) {
+        if (records) writeRecords(*records, frame);
+        else writeJson(json_out, frame);
+    };
 
-        for (auto pose : poses) {
-            pose = pose.inv();
+    // write errors (eg full disk) are fatal
+    auto output_ok = [&]() {
+        if (records ? records->good() : json_out.good()) return true;
+        cerr << "Error writing to " << output << endl;
+        return false;
+    };
 
-            double raw_yaw, raw_pitch, raw_roll;
-            tf::Matrix3x3 mrot(pose(0, 0), pose(0, 1), pose(0, 2), pose(1, 0),
-                               pose(1, 1), pose(1, 2), pose(2, 0), pose(2, 1),
-                               pose(2, 2));
-            mrot.getRPY(raw_roll, raw_pitch, raw_yaw);
+    auto close_output = [&]() {
+        try {
+            if (records) records->close();
+            else json_out.flush();
+        }
+        catch (const std::runtime_error& e) {
+            cerr << e.what() << endl;
+            return false;
+        }
+        return output_ok();
+    };
+
+    // single image
+    if (!use_camera && !is_video) {
+        video_frame frame;
+        frame.index = 0;
+        frame.timestamp = 0.;
+        frame.image = frame_image;
+        frame.features = estimator.update(frame.image, frame.timestamp);
+        frame.poses = estimator.poses();
+        for (size_t i = 0; i < frame.poses.size(); ++i) {
+            frame.reprojection_errors.push_back(estimator.reprojectionError(i));
+        }
+        frame.ids = estimator.faceIds();
 
-            raw_roll = raw_roll - M_PI / 2;
-            raw_yaw = raw_yaw + M_PI / 2;
+        output_frame(frame);
+        if (!close_output()) return 1;
 
-            double yaw, pitch, roll;
+        if (show_frame) {
+            imshow("headpose",
+                   estimator.drawDetections(frame.image, frame.features, frame.poses));
+            while (waitKey(10) != 1048603) {
+            }
+        }
+        return 0;
+    }
 
-            roll = raw_pitch;
-            yaw = raw_yaw;
-            pitch = -raw_roll;
+    // camera or video: decoding and estimation run in parallel
+    VideoPipeline pipeline(estimator, vm["threads"].as<unsigned int>());
+    pipeline.stride = vm["stride"].as<unsigned int>();
+    pipeline.liveSource = !is_video;
 
-            cout << "\"face_" << i << "\":";
-            cout << setprecision(1) << fixed << "{\"yaw\":" << todeg(yaw)
-                 << ", \"pitch\":" << todeg(pitch)
-                 << ", \"roll\":" << todeg(roll) << ",";
-            cout << setprecision(4) << fixed << "\"x\":" << pose(0, 3)
-                 << ", \"y\":" << pose(1, 3) << ", \"z\":" << pose(2, 3)
-                 << "},";
+    auto stats = pipeline.run(video_in, [&](const video_frame& frame) {
+        output_frame(frame);
 
-            i++;
+        // live camera: the output is typically piped to live_plot.py
+        if (!is_video) {
+            if (records) {
+                try {
+                    records->flush();
+                }
+                catch (const std::runtime_error& e) {
+                    cerr << e.what() << endl;
+                    return false;
+                }
+            }
+            else json_out.flush();
         }
-        cout << "}\n" << flush;
+        if (!output_ok()) return false;
 
         if (show_frame) {
             imshow("headpose",
-                   estimator.drawDetections(frame, all_features, poses));
-            if (use_camera) {
-                waitKey(10);
-            } else {
-                while (waitKey(10) != 1048603) {
-                }
-                break;
-            }
+                   estimator.drawDetections(frame.image, frame.features, frame.poses));
+            waitKey(10);
         }
-    }
-}
+        return true;
+    });
+
+    // stdout might be the output stream
+    cerr << "Processed " << stats.processed << " frames (" << stats.decoded
+         << " decoded) in " << stats.duration << "s: " << stats.fps()
+         << " fps" << endl;
 
+    return close_output() ? 0 : 1;
+}
@@ -7,6 +7,9 @@
 #include <opencv2/highgui/highgui.hpp>
 #endif
 
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
 
 #include "../src/head_pose_estimation.hpp"
@@ -14,7 +17,7 @@
 using namespace std;
 using namespace cv;
 
-const static size_t NB_TESTS = 100; // number of time the detection is run, to get better average detection duration
+const static size_t BATCH_SIZE = 64; // number of images loaded in memory at once, in .txt mode
 
 std::vector<std::string> readFileToVector(const std::string& filename)
 {
@@ -30,7 +33,7 @@ std::vector<std::string> readFileToVector(const std::string& filename)
 }
 
 
-void estimate_head_pose_on_frameFileName(const std::string& frameFileName, HeadPoseEstimation estimator, std::vector<head_pose>& prev_poses, bool print_prev_poses)
+void estimate_head_pose_on_frameFileName(const std::string& frameFileName, HeadPoseEstimation& estimator, std::vector<head_pose>& prev_poses, bool print_prev_poses)
 {
     cout << "Estimating head pose on " << frameFileName << endl;
 #ifdef OPENCV3
@@ -39,23 +42,11 @@ void estimate_head_pose_on_frameFileName(const std::string& frameFileName, HeadP
     Mat img = imread(frameFileName, CV_LOAD_IMAGE_COLOR);
 #endif
 
-    auto nbfaces = 0;
-
-    for(size_t i = 0; i < NB_TESTS - 1; i++) {
-        estimator.update(img);
-    }
     auto all_features = estimator.update(img);
+    auto poses = estimator.poses();
 
-    // auto t_detection = getTickCount();
-
-    for(size_t i = 0; i < NB_TESTS; i++) {
-        auto poses = estimator.poses();
-        nbfaces += poses.size(); // this is completly artifical: the only purpose is to make sure the compiler does not optimize away estimator.poses()
-    }
-
-    cout << "Found " << nbfaces/NB_TESTS << " face(s)" << endl;
+    cout << "Found " << poses.size() << " face(s)" << endl;
 
-    auto poses = estimator.poses();
     if (poses.size() > 0) {
         for(auto pose : poses) {
             cout << "Head pose: (" << pose(0,3) << ", " << pose(1,3) << ", " << pose(2,3) << ")" << endl;
@@ -78,6 +69,40 @@ void estimate_head_pose_on_frameFileName(const std::string& frameFileName, HeadP
     #endif
 }
 
+void estimate_head_pose_on_frameFileNames(const std::vector<std::string>& frameFileNames, HeadPoseEstimation& estimator)
+{
+    for (size_t start = 0; start < frameFileNames.size(); start += BATCH_SIZE) {
+        auto end = std::min(start + BATCH_SIZE, frameFileNames.size());
+
+        std::vector<Mat> images;
+        for (size_t i = start; i < end; i++) {
+#ifdef OPENCV3
+            images.push_back(imread(frameFileNames[i], IMREAD_COLOR));
+#else
+            images.push_back(imread(frameFileNames[i], CV_LOAD_IMAGE_COLOR));
+#endif
+        }
+
+        auto results = estimator.updateBatch(images);
+
+        for (size_t i = 0; i < results.size(); i++) {
+            cout << "Estimating head pose on " << frameFileNames[start + i] << endl;
+            cout << "Found " << results[i].poses.size() << " face(s)" << endl;
+            if (results[i].poses.empty()) {
+                cout << "Head pose not calculated!" << endl;
+            }
+            for(auto pose : results[i].poses) {
+                cout << "Head pose: (" << pose(0,3) << ", " << pose(1,3) << ", " << pose(2,3) << ")" << endl;
+            }
+
+    #ifdef HEAD_POSE_ESTIMATION_DEBUG
+            imwrite(std::to_string(start + i) + "_head_pose.png",
+                    estimator.drawDetections(images[i], results[i].features, results[i].poses));
+    #endif
+        }
+    }
+}
+
 
 int main(int argc, char **argv)
 {
@@ -86,7 +111,7 @@ int main(int argc, char **argv)
     if(argc < 3) {
         cerr << argv[0] << " " << STR(GAZR_VERSION) << "\n\nUsage: " 
              << endl << argv[0] << " model.dat frame.{jpg|png}\n\nOR\n\n"
-             << endl << argv[0] << " model.dat filenames.txt" << endl;
+             << endl << argv[0] << " model.dat filenames.txt [nb_threads]" << endl;
 #ifdef HEAD_POSE_ESTIMATION_DEBUG
         cerr <<  "Output: a new frame 'head_pose_<frame>.png'" << endl;
 #endif
@@ -102,13 +127,11 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    auto estimator = HeadPoseEstimation(argv[1]);
-    estimator.focalLength = 500;
+    unsigned int nbThreads = 1;
+    if (argc > 3) nbThreads = std::max(std::atoi(argv[3]), 1);
 
-    cout << "Running " << NB_TESTS << " loops to get a good performance estimate..." << endl;
-#ifdef HEAD_POSE_ESTIMATION_DEBUG
-    cerr <<  "ATTENTION! The benchmark is compiled in DEBUG mode: the performance is no going to be good!!" << endl;
-#endif
+    HeadPoseEstimation estimator(argv[1], 455., 1, nbThreads);
+    estimator.focalLength = 500;
 
     // Prev pose (default)
     head_pose prev_pose = {
@@ -139,17 +162,20 @@ int main(int argc, char **argv)
             cout << fileName << "does not exist, or has no image names" << endl;
         }
 
+        std::vector<std::string> imageFileNames;
         for(auto frameFileName: frameFileNames) {
             if (frameFileName.find("jpg") != std::string::npos or frameFileName.find("png") != std::string::npos) {
-                estimate_head_pose_on_frameFileName(frameFileName, estimator, prev_poses, false);
+                imageFileNames.push_back(frameFileName);
             }
         }
+
+        // images are processed by batches, on nbThreads threads
+        cout << "Processing " << imageFileNames.size() << " images on " << nbThreads << " thread(s)" << endl;
+        estimate_head_pose_on_frameFileNames(imageFileNames, estimator);
     }
 
     auto t_end = getTickCount();
 
-    // cout << "Face feature detection: " <<((t_detection-t_start) / NB_TESTS) /getTickFrequency() * 1000. << "ms;";
-    // cout << "Pose estimation: " <<((t_end-t_detection) / NB_TESTS) /getTickFrequency() * 1000. << "ms;";
     cout << "Total time: " << (t_end-t_start) / getTickFrequency() * 1000. << "ms" << endl;
 
 }
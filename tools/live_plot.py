@@ -22,17 +22,19 @@ plt.show()
 while True:
     line = sys.stdin.readline()
     data = eval(line)
-    if "face_0" in data:
+    if data:
+        # the face tracked for the longest time
+        face = data[min(data, key=lambda name: int(name.split("_")[1]))]
 
-        pitch.append(data["face_0"]["pitch"]-180)
+        pitch.append(face["pitch"]-180)
         del pitch[0]
         pitch_graph.set_data(arange(0, len(pitch)), pitch)
 
-        yaw.append(data["face_0"]["yaw"]-180)
+        yaw.append(face["yaw"]-180)
         del yaw[0]
         yaw_graph.set_data(arange(0, len(yaw)), yaw)
 
-        roll.append(data["face_0"]["roll"])
+        roll.append(face["roll"])
         del roll[0]
         roll_graph.set_data(arange(0, len(roll)), roll)
 
@@ -4,6 +4,7 @@
 #include <opencv2/highgui/highgui.hpp>
 
 #include "../src/head_pose_estimation.hpp"
+#include "video_pipeline.hpp"
 
 #define STR_EXPAND(tok) #tok
 #define STR(tok) STR_EXPAND(tok)
@@ -15,8 +16,6 @@ namespace po = boost::program_options;
 inline double todeg(double rad) { return rad * 180 / M_PI; }
 
 int main(int argc, char **argv) {
-    Mat frame;
-
     namedWindow("headpose");
 
     string video_file;
@@ -29,7 +28,10 @@ int main(int argc, char **argv) {
         "version,v", "shows version and exits")("model", po::value<string>(),
                                                 "dlib's trained face model")(
         "video", po::value<string>(),
-        "video to process. If omitted, uses the first webcam");
+        "video to process. If omitted, uses the first webcam")(
+        "threads", po::value<unsigned int>()->default_value(1), "number of estimation threads (decoding runs in its own thread)")(
+        "stride", po::value<unsigned int>()->default_value(1), "only process one frame out of <stride>")(
+        "hw-decode", "hardware-accelerated video decoding, if available");
 
     po::variables_map vm;
     po::store(
@@ -53,7 +55,7 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    auto estimator = HeadPoseEstimation(vm["model"].as<string>());
+    HeadPoseEstimation estimator(vm["model"].as<string>());
 
     // Configure the video capture
     // ===========================
@@ -65,7 +67,7 @@ int main(int argc, char **argv) {
         video_in.set(cv::CAP_PROP_FRAME_WIDTH, 640);
         video_in.set(cv::CAP_PROP_FRAME_HEIGHT, 480);
     } else {
-        video_in = VideoCapture(vm["video"].as<string>());
+        openVideo(video_in, vm["video"].as<string>(), vm.count("hw-decode") > 0);
     }
 
     // adjust for your webcam!
@@ -76,22 +78,18 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    while (true) {
-        auto ok = video_in.read(frame);
-        if (!ok) break;
-
-        auto t_start = getTickCount();
-
-        auto all_features = estimator.update(frame);
-        auto poses = estimator.poses();
-
-        auto t_end = getTickCount();
-        cout << "Processing time for this frame: "
-             << (t_end - t_start) / getTickFrequency() * 1000. << "ms" << endl;
+    VideoPipeline pipeline(estimator, vm["threads"].as<unsigned int>());
+    pipeline.stride = vm["stride"].as<unsigned int>();
+    pipeline.liveSource = vm.count("video") == 0;
 
+    auto stats = pipeline.run(video_in, [&estimator](const video_frame& frame) {
         imshow("headpose",
-               estimator.drawDetections(frame, all_features, poses));
-        if (waitKey(10) >= 0) break;
-    }
+               estimator.drawDetections(frame.image, frame.features, frame.poses));
+        return waitKey(10) < 0;
+    });
+
+    cout << "Processed " << stats.processed << " frames (" << stats.decoded
+         << " decoded) in " << stats.duration << "s: " << stats.fps()
+         << " fps" << endl;
 }
 
@@ -0,0 +1,105 @@
+#include <boost/program_options.hpp>
+#include <iostream>
+
+#include <dlib/data_io.h>
+#include <dlib/image_processing.h>
+
+#include "../src/head_pose_estimation.hpp"
+
+#define STR_EXPAND(tok) #tok
+#define STR(tok) STR_EXPAND(tok)
+
+using namespace std;
+using namespace dlib;
+namespace po = boost::program_options;
+
+// Only keeps the facial features of REDUCED_LAYOUT, in that order
+void reduce(std::vector<std::vector<full_object_detection>>& faces)
+{
+    for (auto& image_faces : faces) {
+        for (auto& face : image_faces) {
+            if (face.num_parts() != NB_FEATURES) {
+                throw std::runtime_error("The training dataset must be annotated with the 68 facial features");
+            }
+
+            std::vector<dlib::point> parts;
+            for (auto idx : REDUCED_LAYOUT) parts.push_back(face.part(idx));
+            face = full_object_detection(face.get_rect(), parts);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+
+    po::positional_options_description p;
+    p.add("training", 1);
+    p.add("output", 1);
+
+    po::options_description desc("Allowed options");
+    desc.add_options()("help,h", "produce help message")(
+        "version,v", "shows version and exits")(
+        "training", po::value<string>(), "dlib's XML training dataset, annotated with 68 facial features (eg iBUG 300-W)")(
+        "testing", po::value<string>(), "XML testing dataset (optional)")(
+        "output", po::value<string>()->default_value("shape_predictor_reduced.dat"), "trained model")(
+        "cascades", po::value<unsigned long>()->default_value(10), "number of cascades")(
+        "trees", po::value<unsigned long>()->default_value(500), "number of trees per cascade")(
+        "depth", po::value<unsigned long>()->default_value(4), "depth of the regression trees")(
+        "oversampling", po::value<unsigned long>()->default_value(20), "oversampling amount")(
+        "threads", po::value<unsigned long>()->default_value(4), "number of training threads");
+
+    po::variables_map vm;
+    po::store(
+        po::command_line_parser(argc, argv).options(desc).positional(p).run(),
+        vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+        cout << argv[0] << " " << STR(GAZR_VERSION) << "\n\n"
+             << "Trains a landmark model restricted to the " << NB_REDUCED_FEATURES
+             << " facial features used for head pose estimation.\n"
+             << "Fewer cascades, fewer trees or shallower trees give faster (but less accurate) models.\n\n"
+             << desc << "\n";
+        return 1;
+    }
+
+    if (vm.count("version")) {
+        cout << argv[0] << " " << STR(GAZR_VERSION) << "\n";
+        return 0;
+    }
+
+    if (vm.count("training") == 0) {
+        cerr << "You must specify the training dataset (dlib's XML format)." << endl;
+        return 1;
+    }
+
+    dlib::array<array2d<unsigned char>> images_train, images_test;
+    std::vector<std::vector<full_object_detection>> faces_train, faces_test;
+
+    cout << "Loading the training dataset..." << endl;
+    load_image_dataset(images_train, faces_train, vm["training"].as<string>());
+    reduce(faces_train);
+
+    shape_predictor_trainer trainer;
+    trainer.set_cascade_depth(vm["cascades"].as<unsigned long>());
+    trainer.set_num_trees_per_cascade_level(vm["trees"].as<unsigned long>());
+    trainer.set_tree_depth(vm["depth"].as<unsigned long>());
+    trainer.set_oversampling_amount(vm["oversampling"].as<unsigned long>());
+    trainer.set_nu(0.1);
+    trainer.set_num_threads(vm["threads"].as<unsigned long>());
+    trainer.be_verbose();
+
+    auto model = trainer.train(images_train, faces_train);
+
+    cout << "Mean training error: " << test_shape_predictor(model, images_train, faces_train) << " pixels" << endl;
+
+    if (vm.count("testing")) {
+        load_image_dataset(images_test, faces_test, vm["testing"].as<string>());
+        reduce(faces_test);
+        cout << "Mean testing error: " << test_shape_predictor(model, images_test, faces_test) << " pixels" << endl;
+    }
+
+    serialize(vm["output"].as<string>()) << model;
+    cout << "Model saved to " << vm["output"].as<string>() << endl;
+
+    return 0;
+}
@@ -0,0 +1,242 @@
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include <opencv2/core/version.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "video_pipeline.hpp"
+
+using namespace std;
+using namespace cv;
+
+bool openVideo(VideoCapture& video, const string& filename, bool hardwareDecoding)
+{
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && (CV_VERSION_MINOR > 5 || (CV_VERSION_MINOR == 5 && CV_VERSION_REVISION >= 2)))
+    if (hardwareDecoding &&
+        video.open(filename, CAP_ANY, {CAP_PROP_HW_ACCELERATION, VIDEO_ACCELERATION_ANY})) {
+        return true;
+    }
+#endif
+    return video.open(filename);
+}
+
+VideoPipeline::VideoPipeline(const HeadPoseEstimation& prototype, unsigned int nbWorkers) :
+    stride(1),
+    maxFrames(0),
+    nbBuffers(0),
+    liveSource(false),
+    estimator(prototype),
+    nb_workers(std::max(nbWorkers, 1u)),
+    tracker(prototype.trackLifetime),
+    filterPoses(nb_workers > 1 && prototype.poseFiltering)
+{
+    // out of order processing: faces detected in every frame
+    if (nb_workers > 1) {
+        for (size_t i = 0; i < nb_workers; ++i) contexts.push_back(estimator.createContext());
+    }
+}
+
+video_pipeline_stats VideoPipeline::run(VideoCapture& video,
+                                        const function<bool(const video_frame&)>& callback)
+{
+    auto start = chrono::steady_clock::now();
+
+    size_t nb_buffers = nbBuffers > 0 ? nbBuffers : 2 * nb_workers + 2;
+    buffers.resize(nb_buffers);
+    free_buffers.clear();
+    for (size_t i = 0; i < nb_buffers; ++i) free_buffers.push_back(i);
+
+    jobs.clear();
+    results.clear();
+    decoding_done = false;
+    stopping = false;
+    nb_jobs = 0;
+    nb_decoded = 0;
+    error = nullptr;
+
+    thread decoder(&VideoPipeline::decode, this, std::ref(video));
+
+    vector<thread> workers;
+    for (size_t i = 0; i < nb_workers; ++i) {
+        workers.emplace_back(&VideoPipeline::work, this, i);
+    }
+
+    video_pipeline_stats stats;
+
+    // reordering: waits for the results in the order of the video
+    unique_lock<std::mutex> lock(mutex);
+    for (size_t next = 0; ; ++next) {
+        result_available.wait(lock, [this, next]() {
+            return stopping || results.count(next) || (decoding_done && next == nb_jobs);
+        });
+        if (stopping || !results.count(next)) break;
+
+        auto it = results.find(next);
+        auto res = std::move(it->second);
+        results.erase(it);
+
+        lock.unlock();
+        if (nb_workers > 1) trackFaces(res.frame);
+        bool go_on = callback(res.frame);
+        res.frame.image.release();
+        lock.lock();
+
+        stats.processed++;
+        free_buffers.push_back(res.buffer);
+        buffer_free.notify_one();
+
+        if (!go_on) break;
+    }
+    stopping = true;
+    lock.unlock();
+
+    buffer_free.notify_all();
+    job_available.notify_all();
+
+    decoder.join();
+    for (auto& worker : workers) worker.join();
+
+    stats.decoded = nb_decoded;
+    stats.duration = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    if (error) rethrow_exception(error);
+
+    return stats;
+}
+
+void VideoPipeline::decode(VideoCapture& video)
+{
+    auto start = chrono::steady_clock::now();
+
+    size_t index = 0, seq = 0;
+    for (; maxFrames == 0 || seq < maxFrames; ++index) {
+
+        try {
+            // skipped frame: not converted to BGR
+            if (index % std::max(stride, 1u) != 0) {
+                if (!video.grab()) break;
+                continue;
+            }
+
+            size_t buffer;
+            {
+                unique_lock<std::mutex> lock(mutex);
+                buffer_free.wait(lock, [this]() {return stopping || !free_buffers.empty();});
+                if (stopping) break;
+                buffer = free_buffers.back();
+                free_buffers.pop_back();
+            }
+
+            // the buffer is reallocated only if the frame size changes
+            if (!video.read(buffers[buffer]) || buffers[buffer].empty()) {
+                lock_guard<std::mutex> lock(mutex);
+                free_buffers.push_back(buffer);
+                break;
+            }
+
+            double timestamp = liveSource ? chrono::duration<double>(chrono::steady_clock::now() - start).count()
+                                          : video.get(CAP_PROP_POS_MSEC) / 1000.;
+
+            {
+                lock_guard<std::mutex> lock(mutex);
+                jobs.push_back({seq++, buffer, index, timestamp});
+                nb_jobs = seq;
+            }
+            job_available.notify_one();
+        }
+        catch (...) {
+            lock_guard<std::mutex> lock(mutex);
+            if (!error) error = current_exception();
+            stopping = true;
+            break;
+        }
+    }
+
+    {
+        lock_guard<std::mutex> lock(mutex);
+        decoding_done = true;
+        nb_decoded = index;
+    }
+    job_available.notify_all();
+    result_available.notify_all();
+}
+
+void VideoPipeline::work(size_t worker)
+{
+    while (true) {
+        job next_job;
+        {
+            unique_lock<std::mutex> lock(mutex);
+            job_available.wait(lock, [this]() {return stopping || decoding_done || !jobs.empty();});
+            if (stopping || jobs.empty()) return;
+            next_job = jobs.front();
+            jobs.erase(jobs.begin());
+        }
+
+        video_frame frame;
+        frame.index = next_job.index;
+        frame.timestamp = next_job.timestamp;
+        frame.image = buffers[next_job.buffer];
+
+        try {
+            if (nb_workers > 1) {
+                auto results = estimator.estimate(frame.image, contexts[worker]);
+                frame.features = std::move(results.features);
+                frame.poses = std::move(results.poses);
+                frame.reprojection_errors = std::move(results.reprojection_errors);
+            }
+            else {
+                frame.features = estimator.update(frame.image, frame.timestamp);
+                frame.poses = estimator.poses();
+                for (size_t i = 0; i < frame.poses.size(); ++i) {
+                    frame.reprojection_errors.push_back(estimator.reprojectionError(i));
+                }
+                frame.ids = estimator.faceIds();
+            }
+        }
+        catch (...) {
+            {
+                lock_guard<std::mutex> lock(mutex);
+                if (!error) error = current_exception();
+                stopping = true;
+            }
+            buffer_free.notify_all();
+            job_available.notify_all();
+            result_available.notify_all();
+            return;
+        }
+
+        {
+            lock_guard<std::mutex> lock(mutex);
+            results[next_job.seq] = {std::move(frame), next_job.buffer};
+        }
+        result_available.notify_one();
+    }
+}
+
+void VideoPipeline::trackFaces(video_frame& frame)
+{
+    vector<dlib::rectangle> boxes;
+    for (const auto& features : frame.features) {
+        // the features not fitted by a reduced model are (-1, -1)
+        vector<Point> fitted;
+        copy_if(features.begin(), features.end(), back_inserter(fitted),
+                [](const Point& p) {return p.x >= 0 && p.y >= 0;});
+        auto box = boundingRect(fitted);
+        boxes.emplace_back(box.x, box.y, box.x + box.width - 1, box.y + box.height - 1);
+    }
+    frame.ids = tracker.update(boxes);
+
+    if (!filterPoses) return;
+
+    for (size_t i = 0; i < frame.poses.size(); ++i) {
+        auto& filter = filters.emplace(frame.ids[i], PoseFilter(estimator.filterMinCutoff, estimator.filterBeta)).first->second;
+        frame.poses[i] = filter.filter(frame.poses[i], frame.timestamp);
+    }
+
+    for (auto it = filters.begin(); it != filters.end();) {
+        if (tracker.isTracked(it->first)) ++it;
+        else it = filters.erase(it);
+    }
+}
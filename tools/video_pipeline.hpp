@@ -0,0 +1,137 @@
+#ifndef __VIDEO_PIPELINE
+#define __VIDEO_PIPELINE
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef OPENCV3
+#include <opencv2/videoio.hpp>
+#else
+#include <opencv2/highgui/highgui.hpp>
+#endif
+
+#include "../src/face_tracker.hpp"
+#include "../src/head_pose_estimation.hpp"
+#include "../src/pose_filter.hpp"
+
+// One processed frame, as passed (in order) to the VideoPipeline's callback
+struct video_frame {
+    size_t index;     // index of the frame in the video (with striding, not contiguous)
+    double timestamp; // seconds
+
+    cv::Mat image;    // only valid during the callback (the buffer is reused)
+
+    std::vector<std::vector<cv::Point>> features;
+    std::vector<head_pose> poses;
+    std::vector<double> reprojection_errors;
+    std::vector<unsigned long> ids;
+};
+
+struct video_pipeline_stats {
+    size_t decoded = 0;   // frames read from the video, including the skipped ones
+    size_t processed = 0; // frames passed to the callback
+    double duration = 0.; // seconds
+
+    double fps() const {return duration > 0 ? processed / duration : 0.;}
+};
+
+/** Opens a video file, with hardware-accelerated decoding if requested and
+ * available (OpenCV >= 4.5.2, FFmpeg or GStreamer backends; silently falls
+ * back to software decoding otherwise).
+ */
+bool openVideo(cv::VideoCapture& video, const std::string& filename, bool hardwareDecoding = false);
+
+/** Decodes a video (or a camera) and estimates the head poses of its frames
+ * in a producer/consumer pipeline: one thread decodes the frames into a ring
+ * of reusable buffers while nbWorkers estimators process the previous
+ * frames. The results are passed to the callback in the order of the video,
+ * from the thread calling run().
+ *
+ * With a single worker, the frames are processed in order by one estimator,
+ * with tracking between frames (see HeadPoseEstimation::detectionInterval),
+ * like a plain read()/update() loop. With several workers, the frames are
+ * processed independently (faces detected in every frame): the face ids and
+ * the pose filtering are then computed by the pipeline when the results are
+ * reordered.
+ */
+class VideoPipeline {
+
+public:
+
+    /** The frames are processed by a copy of prototype (sharing its model
+     * and its settings): with several workers, by concurrent calls to its
+     * stateless estimate(), one context per worker.
+     */
+    VideoPipeline(const HeadPoseEstimation& prototype, unsigned int nbWorkers = 1);
+
+    /** Processes the video until its end, or until the callback returns
+     * false. Exceptions thrown by the workers are rethrown here.
+     */
+    video_pipeline_stats run(cv::VideoCapture& video,
+                             const std::function<bool(const video_frame&)>& callback);
+
+    // only process one frame out of 'stride' (the other frames are grabbed,
+    // but not decoded to BGR)
+    unsigned int stride;
+
+    // stop after that many processed frames (0: whole video)
+    size_t maxFrames;
+
+    // number of frame buffers (0: twice the number of workers, plus 2); the
+    // decoder blocks when they are all in use
+    size_t nbBuffers;
+
+    // live source (camera): the timestamps come from the system's steady
+    // clock instead of the video's
+    bool liveSource;
+
+private:
+
+    HeadPoseEstimation estimator;
+
+    // one per worker, if more than one
+    std::vector<EstimationContext> contexts;
+    size_t nb_workers;
+
+    // filtering and face ids, when the frames are processed out of order
+    FaceTracker tracker;
+    std::map<unsigned long, PoseFilter> filters;
+    bool filterPoses;
+
+    struct job {
+        size_t seq; // position in the output order
+        size_t buffer;
+        size_t index;
+        double timestamp;
+    };
+
+    std::mutex mutex;
+    std::condition_variable buffer_free, job_available, result_available;
+
+    std::vector<cv::Mat> buffers;
+    std::vector<size_t> free_buffers;
+
+    struct result {
+        video_frame frame;
+        size_t buffer;
+    };
+
+    std::vector<job> jobs;             // FIFO (jobs are few)
+    std::map<size_t, result> results;  // by seq
+
+    bool decoding_done, stopping;
+    size_t nb_jobs, nb_decoded;
+    std::exception_ptr error;
+
+    void decode(cv::VideoCapture& video);
+    void work(size_t worker);
+
+    void trackFaces(video_frame& frame);
+};
+
+#endif // __VIDEO_PIPELINE